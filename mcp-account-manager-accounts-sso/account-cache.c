@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "account-cache.h"
+#include "sso-log.h"
+
+#include <string.h>
+
+#define DEBUG(...) \
+  SSO_LOG (SSO_LOG_LOAD, SSO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/* Rough per allocation overhead of the hash tables and the allocator */
+#define ACCOUNT_OVERHEAD (sizeof (CachedAccount) + 4 * sizeof (gpointer))
+#define VALUE_OVERHEAD (4 * sizeof (gpointer))
+
+typedef struct
+{
+  gchar *account_name;
+  /* alloc'ed key -> alloc'ed value, NULL when known to be unset */
+  GHashTable *values;
+  gsize values_bytes;
+  gsize extra_bytes;
+  /* Link in the LRU queue, whose data is this */
+  GList link;
+} CachedAccount;
+
+struct _AccountCache
+{
+  gsize budget;
+  gsize resident;
+
+  /* account_name -> owned CachedAccount */
+  GHashTable *accounts;
+  /* Most recently used first */
+  GQueue lru;
+
+  AccountCacheEvictFunc evict;
+  gpointer user_data;
+
+  guint64 hits;
+  guint64 misses;
+  guint64 evictions;
+  /* Time spent getting the values that were missing, whether never cached,
+   * evicted or invalidated */
+  gint64 refill_usec;
+  guint64 refills;
+};
+
+static gsize
+_value_size (const gchar *key,
+    const gchar *value)
+{
+  return strlen (key) + 1 + (value != NULL ? strlen (value) + 1 : 0) +
+      VALUE_OVERHEAD;
+}
+
+static gsize
+_cached_account_size (CachedAccount *cached)
+{
+  return ACCOUNT_OVERHEAD + strlen (cached->account_name) + 1 +
+      cached->values_bytes + cached->extra_bytes;
+}
+
+static void
+_cached_account_free (gpointer data)
+{
+  CachedAccount *cached = data;
+
+  g_hash_table_unref (cached->values);
+  g_free (cached->account_name);
+  g_slice_free (CachedAccount, cached);
+}
+
+/* Removes the account from the cache, freeing it */
+static void
+_drop (AccountCache *cache,
+    CachedAccount *cached)
+{
+  cache->resident -= _cached_account_size (cached);
+  g_queue_unlink (&cache->lru, &cached->link);
+  g_hash_table_remove (cache->accounts, cached->account_name);
+}
+
+static void
+_shrink (AccountCache *cache,
+    CachedAccount *keep)
+{
+  GList *l, *prev;
+
+  for (l = g_queue_peek_tail_link (&cache->lru);
+      l != NULL && cache->resident > cache->budget;
+      l = prev)
+    {
+      CachedAccount *cached = l->data;
+
+      prev = l->prev;
+
+      /* Whatever is being cached right now stays, even if over budget */
+      if (cached == keep)
+        break;
+
+      /* Still held, so still accounted for; try the next one */
+      if (cached->extra_bytes > 0 && cache->evict != NULL &&
+          !cache->evict (cached->account_name, cache->user_data))
+        continue;
+
+      cache->evictions++;
+      _drop (cache, cached);
+    }
+}
+
+/* Returns the account's cache, moved to the head of the LRU queue */
+static CachedAccount *
+_touch (AccountCache *cache,
+    const gchar *account_name,
+    gboolean create)
+{
+  CachedAccount *cached = g_hash_table_lookup (cache->accounts,
+      account_name);
+
+  if (cached == NULL)
+    {
+      if (!create)
+        return NULL;
+
+      cached = g_slice_new0 (CachedAccount);
+      cached->account_name = g_strdup (account_name);
+      cached->values = g_hash_table_new_full (g_str_hash, g_str_equal,
+          g_free, g_free);
+      cached->link.data = cached;
+
+      g_hash_table_insert (cache->accounts, cached->account_name, cached);
+      g_queue_push_head_link (&cache->lru, &cached->link);
+      cache->resident += _cached_account_size (cached);
+      return cached;
+    }
+
+  g_queue_unlink (&cache->lru, &cached->link);
+  g_queue_push_head_link (&cache->lru, &cached->link);
+  return cached;
+}
+
+AccountCache *
+account_cache_new (gsize budget,
+    AccountCacheEvictFunc evict,
+    gpointer user_data)
+{
+  AccountCache *cache = g_slice_new0 (AccountCache);
+
+  cache->budget = budget;
+  cache->evict = evict;
+  cache->user_data = user_data;
+  cache->accounts = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+      _cached_account_free);
+  g_queue_init (&cache->lru);
+
+  return cache;
+}
+
+void
+account_cache_free (AccountCache *cache)
+{
+  if (cache == NULL)
+    return;
+
+  /* The queue links are embedded in the accounts */
+  g_hash_table_unref (cache->accounts);
+  g_slice_free (AccountCache, cache);
+}
+
+gboolean
+account_cache_lookup (AccountCache *cache,
+    const gchar *account_name,
+    const gchar *key,
+    const gchar **value)
+{
+  CachedAccount *cached = _touch (cache, account_name, FALSE);
+  gpointer v;
+
+  if (cached == NULL ||
+      !g_hash_table_lookup_extended (cached->values, key, NULL, &v))
+    {
+      cache->misses++;
+      return FALSE;
+    }
+
+  cache->hits++;
+  *value = v;
+  return TRUE;
+}
+
+void
+account_cache_insert (AccountCache *cache,
+    const gchar *account_name,
+    const gchar *key,
+    const gchar *value,
+    gint64 cost_usec)
+{
+  CachedAccount *cached;
+  gpointer old;
+  gsize size;
+
+  if (cache->budget == 0)
+    return;
+
+  cached = _touch (cache, account_name, TRUE);
+
+  if (g_hash_table_lookup_extended (cached->values, key, NULL, &old))
+    {
+      size = _value_size (key, old);
+      cached->values_bytes -= size;
+      cache->resident -= size;
+    }
+  else if (cost_usec > 0)
+    {
+      cache->refills++;
+      cache->refill_usec += cost_usec;
+    }
+
+  g_hash_table_replace (cached->values, g_strdup (key), g_strdup (value));
+
+  size = _value_size (key, value);
+  cached->values_bytes += size;
+  cache->resident += size;
+
+  _shrink (cache, cached);
+}
+
+void
+account_cache_set_extra (AccountCache *cache,
+    const gchar *account_name,
+    gsize bytes)
+{
+  CachedAccount *cached;
+
+  if (cache->budget == 0)
+    return;
+
+  cached = _touch (cache, account_name, bytes > 0);
+  if (cached == NULL)
+    return;
+
+  cache->resident -= cached->extra_bytes;
+  cached->extra_bytes = bytes;
+  cache->resident += bytes;
+
+  _shrink (cache, cached);
+}
+
+void
+account_cache_invalidate (AccountCache *cache,
+    const gchar *account_name)
+{
+  CachedAccount *cached = g_hash_table_lookup (cache->accounts,
+      account_name);
+
+  if (cached == NULL)
+    return;
+
+  g_hash_table_remove_all (cached->values);
+  cache->resident -= cached->values_bytes;
+  cached->values_bytes = 0;
+}
+
+void
+account_cache_remove (AccountCache *cache,
+    const gchar *account_name)
+{
+  CachedAccount *cached = g_hash_table_lookup (cache->accounts,
+      account_name);
+
+  if (cached != NULL)
+    _drop (cache, cached);
+}
+
+gsize
+account_cache_get_resident (AccountCache *cache)
+{
+  return cache->resident;
+}
+
+void
+account_cache_log_stats (AccountCache *cache)
+{
+  if (cache == NULL)
+    return;
+
+  DEBUG ("Accounts SSO: cache holds %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT
+      " bytes for %u account(s); %" G_GUINT64_FORMAT " hit(s), %"
+      G_GUINT64_FORMAT " miss(es), %" G_GUINT64_FORMAT " eviction(s), %"
+      G_GUINT64_FORMAT " refill(s) taking %" G_GINT64_FORMAT "us",
+      cache->resident, cache->budget, g_hash_table_size (cache->accounts),
+      cache->hits, cache->misses, cache->evictions, cache->refills,
+      cache->refill_usec);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __ACCOUNT_CACHE_H__
+#define __ACCOUNT_CACHE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Data the plugin caches per account, kept under a byte budget: when over
+ * it, all the data of the least recently used accounts is dropped. Only
+ * cached data is accounted for here, never what identifies the accounts. */
+typedef struct _AccountCache AccountCache;
+
+/* Called before the data of an account is dropped to make room; it must
+ * release what was accounted for with account_cache_set_extra() and return
+ * TRUE, or return FALSE if that can't be released for now, in which case
+ * the account stays cached and accounted for. It must not call back into
+ * the cache. */
+typedef gboolean (*AccountCacheEvictFunc) (const gchar *account_name,
+    gpointer user_data);
+
+/* A budget of 0 disables caching */
+AccountCache *account_cache_new (gsize budget,
+    AccountCacheEvictFunc evict,
+    gpointer user_data);
+void account_cache_free (AccountCache *cache);
+
+/* Returns TRUE and sets value, possibly to NULL if the key is known to be
+ * unset, if the key of the account is cached */
+gboolean account_cache_lookup (AccountCache *cache,
+    const gchar *account_name,
+    const gchar *key,
+    const gchar **value);
+
+/* Caches a value, which may be NULL; cost_usec is the time it took to
+ * get it, for the refill statistics */
+void account_cache_insert (AccountCache *cache,
+    const gchar *account_name,
+    const gchar *key,
+    const gchar *value,
+    gint64 cost_usec);
+
+/* Accounts for memory held elsewhere for the account, e.g. a loaded
+ * AgAccountService; 0 to stop accounting for it */
+void account_cache_set_extra (AccountCache *cache,
+    const gchar *account_name,
+    gsize bytes);
+
+/* Drops the cached values of the account, after it changed */
+void account_cache_invalidate (AccountCache *cache,
+    const gchar *account_name);
+/* Forgets everything about the account, after it was deleted */
+void account_cache_remove (AccountCache *cache,
+    const gchar *account_name);
+
+gsize account_cache_get_resident (AccountCache *cache);
+void account_cache_log_stats (AccountCache *cache);
+
+G_END_DECLS
+
+#endif
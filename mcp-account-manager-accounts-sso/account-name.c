@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "account-name.h"
+
+#include <telepathy-glib/telepathy-glib.h>
+
+gchar *
+account_name_build (const gchar *cm_name,
+    const gchar *protocol_name,
+    const gchar *service_name,
+    guint account_id)
+{
+  gchar *cm, *protocol, *service;
+  gchar *account_name;
+
+  if (tp_str_empty (cm_name) || tp_str_empty (protocol_name))
+    return NULL;
+
+  /* Generate a unique and predictable name using service name and account ID, instead of
+   * mcp_account_manager_get_unique_name. Manager name and service name are escaped, and
+   * dashes are replaced with underscores in protocol name and service name. This matches
+   * mcp_account_manager_get_unique_name's behavior. */
+  cm = tp_escape_as_identifier (cm_name);
+  protocol = g_strdelimit (g_strdup (protocol_name), "-", '_');
+  service = tp_escape_as_identifier (service_name);
+
+  account_name = g_strdup_printf ("%s/%s/%s_%u", cm, protocol, service,
+      account_id);
+
+  g_free (cm);
+  g_free (protocol);
+  g_free (service);
+  return account_name;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __ACCOUNT_NAME_H__
+#define __ACCOUNT_NAME_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Telepathy settings of a service live under this prefix */
+#define KEY_PREFIX "telepathy/"
+/* The MC account name of the service, once it has been imported */
+#define KEY_ACCOUNT_NAME "mc-account-name"
+
+/* Returns the MC account name of a service of an account, built from its
+ * connection manager and protocol like mcp_account_manager_get_unique_name()
+ * does, or NULL if either of them is empty. Shared with the provisioning
+ * tool, so both name accounts the same way. */
+gchar *account_name_build (const gchar *cm_name,
+    const gchar *protocol_name,
+    const gchar *service_name,
+    guint account_id);
+
+G_END_DECLS
+
+#endif
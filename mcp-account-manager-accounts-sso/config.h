@@ -0,0 +1,5 @@
+/* Log calls more verbose than this level are compiled out, see sso-log.h:
+ * 0 none, 1 info, 2 debug, 3 verbose (every storage call) */
+#ifndef SSO_LOG_MAX_LEVEL
+#define SSO_LOG_MAX_LEVEL 2
+#endif
@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "event-trace.h"
+#include "sso-log.h"
+
+#include <string.h>
+
+#define DEBUG(...) \
+  SSO_LOG (SSO_LOG_LOAD, SSO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/* Records are small; keep the plugin from hitting the disk on each one */
+#define TRACE_BUFFER_SIZE (64 * 1024)
+
+struct _EventTrace
+{
+  FILE *file;
+  gint64 last_start;
+};
+
+static const gchar * const event_names[EVENT_TRACE_N_EVENTS] = {
+  NULL,
+  "account-created",
+  "account-deleted",
+  "service-enabled",
+  "service-disabled",
+  "service-changed",
+  "signon-info",
+  "get",
+  "list",
+  "set",
+  "create",
+  "delete",
+  "commit",
+  "ready",
+  "get-identifier",
+  "get-restrictions",
+  "get-additional-info",
+};
+
+static void
+_write_u32 (FILE *file,
+    guint32 value)
+{
+  guint32 le = GUINT32_TO_LE (value);
+
+  fwrite (&le, sizeof (le), 1, file);
+}
+
+static void
+_write_i64 (FILE *file,
+    gint64 value)
+{
+  gint64 le = GINT64_TO_LE (value);
+
+  fwrite (&le, sizeof (le), 1, file);
+}
+
+static void
+_write_varint (FILE *file,
+    guint64 value)
+{
+  do
+    {
+      guchar byte = value & 0x7f;
+
+      value >>= 7;
+      if (value != 0)
+        byte |= 0x80;
+
+      putc (byte, file);
+    }
+  while (value != 0);
+}
+
+static void
+_write_zigzag (FILE *file,
+    gint64 value)
+{
+  _write_varint (file, ((guint64) value << 1) ^ (guint64) (value >> 63));
+}
+
+static void
+_write_string (FILE *file,
+    const gchar *str)
+{
+  gsize len = (str != NULL) ? strlen (str) : 0;
+
+  _write_varint (file, len);
+  if (len > 0)
+    fwrite (str, 1, len, file);
+}
+
+EventTrace *
+event_trace_open_from_env (void)
+{
+  const gchar *path = g_getenv (EVENT_TRACE_ENV);
+  EventTrace *trace;
+  FILE *file;
+
+  if (path == NULL || path[0] == '\0')
+    return NULL;
+
+  file = fopen (path, "wb");
+  if (file == NULL)
+    {
+      DEBUG ("Accounts SSO: cannot open trace file %s", path);
+      return NULL;
+    }
+
+  setvbuf (file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+
+  fwrite (EVENT_TRACE_MAGIC, 1, strlen (EVENT_TRACE_MAGIC), file);
+  _write_u32 (file, EVENT_TRACE_VERSION);
+  _write_i64 (file, g_get_real_time ());
+
+  trace = g_slice_new0 (EventTrace);
+  trace->file = file;
+  trace->last_start = g_get_monotonic_time ();
+
+  DEBUG ("Accounts SSO: recording events to %s", path);
+  return trace;
+}
+
+void
+event_trace_close (EventTrace *trace)
+{
+  if (trace == NULL)
+    return;
+
+  fclose (trace->file);
+  g_slice_free (EventTrace, trace);
+}
+
+void
+event_trace_flush (EventTrace *trace)
+{
+  if (trace != NULL)
+    fflush (trace->file);
+}
+
+gint64
+event_trace_begin (EventTrace *trace)
+{
+  if (trace == NULL)
+    return 0;
+
+  return g_get_monotonic_time ();
+}
+
+void
+event_trace_record (EventTrace *trace,
+    EventTraceEvent event,
+    gint64 start,
+    guint account_id,
+    const gchar *name,
+    const gchar *detail)
+{
+  gint64 now;
+
+  if (trace == NULL)
+    return;
+
+  now = g_get_monotonic_time ();
+
+  /* Records are written when the event completes, so an event containing
+   * others (e.g. a ready() replaying account creations) starts before the
+   * previous record */
+  putc (event, trace->file);
+  _write_zigzag (trace->file, start - trace->last_start);
+  _write_varint (trace->file, MAX (now - start, 0));
+  _write_varint (trace->file, account_id);
+  _write_string (trace->file, name);
+  _write_string (trace->file, detail);
+
+  trace->last_start = start;
+}
+
+const gchar *
+event_trace_event_name (EventTraceEvent event)
+{
+  if (event <= 0 || event >= EVENT_TRACE_N_EVENTS)
+    return "unknown";
+
+  return event_names[event];
+}
+
+gboolean
+event_trace_read_header (FILE *file,
+    gint64 *wall_clock)
+{
+  gchar magic[sizeof (EVENT_TRACE_MAGIC) - 1];
+  guint32 version;
+  gint64 time;
+
+  if (fread (magic, 1, sizeof (magic), file) != sizeof (magic) ||
+      memcmp (magic, EVENT_TRACE_MAGIC, sizeof (magic)) != 0)
+    return FALSE;
+
+  if (fread (&version, sizeof (version), 1, file) != 1 ||
+      GUINT32_FROM_LE (version) != EVENT_TRACE_VERSION)
+    return FALSE;
+
+  if (fread (&time, sizeof (time), 1, file) != 1)
+    return FALSE;
+
+  if (wall_clock != NULL)
+    *wall_clock = GINT64_FROM_LE (time);
+
+  return TRUE;
+}
+
+static gboolean
+_read_varint (FILE *file,
+    guint64 *value)
+{
+  guint shift = 0;
+  int c;
+
+  *value = 0;
+  do
+    {
+      c = getc (file);
+      if (c == EOF || shift > 63)
+        return FALSE;
+
+      *value |= (guint64) (c & 0x7f) << shift;
+      shift += 7;
+    }
+  while (c & 0x80);
+
+  return TRUE;
+}
+
+static gboolean
+_read_string (FILE *file,
+    gchar **str)
+{
+  guint64 len;
+
+  g_free (*str);
+  *str = NULL;
+
+  if (!_read_varint (file, &len) || len > G_MAXUINT16)
+    return FALSE;
+
+  *str = g_malloc (len + 1);
+  if (fread (*str, 1, len, file) != len)
+    return FALSE;
+
+  (*str)[len] = '\0';
+  return TRUE;
+}
+
+gboolean
+event_trace_read_record (FILE *file,
+    EventTraceRecord *record)
+{
+  guint64 zigzag, duration, account_id;
+  int event = getc (file);
+
+  if (event == EOF ||
+      !_read_varint (file, &zigzag) ||
+      !_read_varint (file, &duration) ||
+      !_read_varint (file, &account_id) ||
+      !_read_string (file, &record->name) ||
+      !_read_string (file, &record->detail))
+    {
+      g_free (record->name);
+      g_free (record->detail);
+      record->name = record->detail = NULL;
+      return FALSE;
+    }
+
+  record->event = event;
+  record->start += ((gint64) (zigzag >> 1)) ^ -((gint64) (zigzag & 1));
+  record->duration = duration;
+  record->account_id = account_id;
+
+  return TRUE;
+}
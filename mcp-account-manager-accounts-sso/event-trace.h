@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EVENT_TRACE_H__
+#define __EVENT_TRACE_H__
+
+#include <stdio.h>
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Path of the trace file; tracing is disabled when unset */
+#define EVENT_TRACE_ENV "MC_ACCOUNTS_SSO_TRACE"
+
+/* Trace file layout, all integers little endian:
+ *
+ *   header: "MCSSOTRC", u32 version, i64 wall clock time at start (usec)
+ *   record: u8 event,
+ *           zigzag varint start (usec since the previous record's start;
+ *             negative for an event containing the previous ones, as
+ *             records are written when events complete),
+ *           varint duration (usec),
+ *           varint account id (0 if not known),
+ *           varint length + bytes of name (account name or "")
+ *           varint length + bytes of detail (setting key or "")
+ *
+ * Varints are unsigned LEB128; zigzag varints map 0, -1, 1, -2... to 0, 1,
+ * 2, 3... first. New events may only be appended. */
+#define EVENT_TRACE_MAGIC "MCSSOTRC"
+#define EVENT_TRACE_VERSION 2
+
+typedef enum {
+  /* libaccounts / libsignon events */
+  EVENT_TRACE_ACCOUNT_CREATED = 1,
+  EVENT_TRACE_ACCOUNT_DELETED,
+  EVENT_TRACE_SERVICE_ENABLED,
+  EVENT_TRACE_SERVICE_DISABLED,
+  EVENT_TRACE_SERVICE_CHANGED,
+  EVENT_TRACE_SIGNON_INFO,
+
+  /* McpAccountStorage calls */
+  EVENT_TRACE_IFACE_GET,
+  EVENT_TRACE_IFACE_LIST,
+  EVENT_TRACE_IFACE_SET,
+  EVENT_TRACE_IFACE_CREATE,
+  EVENT_TRACE_IFACE_DELETE,
+  EVENT_TRACE_IFACE_COMMIT,
+  EVENT_TRACE_IFACE_READY,
+  EVENT_TRACE_IFACE_GET_IDENTIFIER,
+  EVENT_TRACE_IFACE_GET_RESTRICTIONS,
+  EVENT_TRACE_IFACE_GET_ADDITIONAL_INFO,
+
+  EVENT_TRACE_N_EVENTS
+} EventTraceEvent;
+
+typedef struct _EventTrace EventTrace;
+
+/* Returns NULL if tracing is disabled or the file cannot be created */
+EventTrace *event_trace_open_from_env (void);
+void event_trace_close (EventTrace *trace);
+void event_trace_flush (EventTrace *trace);
+
+/* Returns the time to pass to event_trace_record(), or 0 if trace is NULL */
+gint64 event_trace_begin (EventTrace *trace);
+void event_trace_record (EventTrace *trace,
+    EventTraceEvent event,
+    gint64 start,
+    guint account_id,
+    const gchar *name,
+    const gchar *detail);
+
+const gchar *event_trace_event_name (EventTraceEvent event);
+
+/* Reading back, for tools */
+typedef struct {
+  EventTraceEvent event;
+  /* usec since the start of the trace */
+  gint64 start;
+  gint64 duration;
+  guint account_id;
+  gchar *name;
+  gchar *detail;
+} EventTraceRecord;
+
+gboolean event_trace_read_header (FILE *file,
+    gint64 *wall_clock);
+/* record must be zeroed before the first call and reused for the next
+ * ones, since starts are stored as deltas. Returns FALSE at the end of the
+ * file or on a truncated record, after freeing the strings in record. */
+gboolean event_trace_read_record (FILE *file,
+    EventTraceRecord *record);
+
+G_END_DECLS
+
+#endif
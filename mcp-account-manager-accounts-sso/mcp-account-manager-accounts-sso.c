@@ -20,6 +20,16 @@
 
 #include "config.h"
 #include "mcp-account-manager-accounts-sso.h"
+#include "oauth2-token-cache.h"
+#include "event-trace.h"
+#include "startup-profile.h"
+#include "usage-store.h"
+#include "sso-counters.h"
+#include "store-tracker.h"
+#include "account-cache.h"
+#include "account-name.h"
+#include "protocol-schema.h"
+#include "sso-log.h"
 
 #include <telepathy-glib/telepathy-glib.h>
 
@@ -42,15 +52,66 @@
 #define PLUGIN_DESCRIPTION "Provide Telepathy Accounts from Accounts-SSO via libaccounts-glib"
 #define PLUGIN_PROVIDER ACCOUNTS_SSO_PROVIDER
 
-#define DEBUG g_debug
-
-#define SERVICE_TYPE "IM"
-#define KEY_PREFIX "telepathy/"
-#define KEY_ACCOUNT_NAME "mc-account-name"
+#define DEBUG_LOAD(...) \
+  SSO_LOG (SSO_LOG_LOAD, SSO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define DEBUG_SIGNON(...) \
+  SSO_LOG (SSO_LOG_SIGNON, SSO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define DEBUG_SIGNALS(...) \
+  SSO_LOG (SSO_LOG_SIGNALS, SSO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define DEBUG_IFACE(...) \
+  SSO_LOG (SSO_LOG_STORAGE_IFACE, SSO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define VERBOSE_IFACE(...) \
+  SSO_LOG (SSO_LOG_STORAGE_IFACE, SSO_LOG_LEVEL_VERBOSE, __VA_ARGS__)
+
+/* Colon-separated list of libaccounts service types exposed to MC */
+#define SERVICE_TYPES_ENV "MC_ACCOUNTS_SSO_SERVICE_TYPES"
+#define DEFAULT_SERVICE_TYPES "IM"
 #define KEY_READONLY_PARAMS "mc-readonly-params"
+#define KEY_PASSWORD "param-password"
+
+/* Maps libaccounts provider names to Telepathy service names, looked up
+ * in the system config dirs; entries override the built-in ones */
+#define PROVIDER_SERVICES_FILE "telepathy-accounts-signon/services.conf"
+#define PROVIDER_SERVICES_GROUP "Services"
+
+/* Signon username lookups: each query has a deadline, transient failures
+ * are retried with exponential backoff, and identities that still fail
+ * are not queried again for a growing while. */
+#define SIGNON_QUERY_TIMEOUT_SECONDS 5
+#define SIGNON_MAX_ATTEMPTS 3
+#define SIGNON_RETRY_BASE_SECONDS 1
+#define SIGNON_FAILURE_BASE_SECONDS 60
+#define SIGNON_FAILURE_MAX_SECONDS 3600
+
+/* Longest waits for pending account stores to complete; only their
+ * completions are dispatched meanwhile */
+#define COMMIT_FLUSH_TIMEOUT_MS 500
+#define DISPOSE_FLUSH_TIMEOUT_MS 2000
+
+/* Set to 1 to keep only a small record per account service, creating the
+ * AgAccountService when needed and dropping it once idle */
+#define LAZY_SERVICES_ENV "MC_ACCOUNTS_SSO_LAZY_SERVICES"
+#define LAZY_SERVICE_IDLE_SECONDS 30
+
+/* Byte budget of the data cached for accounts, including the services
+ * loaded in lazy mode: the default leaves room for about a hundred of them
+ * with their values, so that loading all of MC's accounts doesn't churn */
+#define CACHE_BUDGET_ENV "MC_ACCOUNTS_SSO_CACHE_BUDGET"
+#define DEFAULT_CACHE_BUDGET (1024 * 1024)
+/* Rough footprint of a loaded AgAccountService, with its AgAccount share */
+#define LOADED_SERVICE_BYTES (8 * 1024)
+
+/* The keys MC asked for the most in previous runs are read for all accounts
+ * once ready, one account at a time, in a single pass over its settings */
+#define PREFETCH_MAX_KEYS 16
+#define PREFETCH_MIN_ACCESSES 2
 
 static void account_storage_iface_init (McpAccountStorageIface *iface);
 static void create_account(AgAccountService *service, McpAccountManagerAccountsSso *self);
+static void _special_keys_init (void);
+static void _load_provider_services (McpAccountManagerAccountsSso *self);
+static gint _account_name_compare_rank (gconstpointer a, gconstpointer b,
+    gpointer user_data);
 
 G_DEFINE_TYPE_WITH_CODE (McpAccountManagerAccountsSso, mcp_account_manager_accounts_sso,
     G_TYPE_OBJECT,
@@ -63,24 +124,119 @@ struct _McpAccountManagerAccountsSsoPrivate
 
   AgManager *manager;
 
-  /* alloc'ed string -> ref'ed AgAccountService
+  /* Set of alloc'ed service types.
+   * All configured service types share the same manager; services of
+   * other types are ignored. */
+  GHashTable *service_types;
+
+  /* alloc'ed provider name -> alloc'ed Telepathy service name */
+  GHashTable *provider_services;
+
+  /* entry's account_name -> owned AccountEntry
    * The key is the account_name, an MC unique identifier.
    * Note: There could be multiple services in this table having the same
    * AgAccount, even if unlikely. */
   GHashTable *accounts;
 
+  /* AgAccountId -> GPtrArray of the AccountEntry of its services, so
+   * events about other accounts are dismissed without looking at them */
+  GHashTable *account_index;
+
   /* List of AgAccountService that are monitored but don't yet have an
    * associated telepathy account and identifier. A reference must be held
-   * to watch signals. */
+   * to watch signals. Unused in lazy mode, where the manager signals
+   * cover them. */
   GList *pending_accounts;
 
   /* Queue of owned DelayedSignalData */
   GQueue *pending_signals;
 
+  /* OAuth2 tokens of the services in accounts, by credentials id */
+  OAuth2TokenCache *tokens;
+
+  /* Recorder of every event and storage call, NULL unless enabled */
+  EventTrace *trace;
+
+  /* credentials id -> owned SignonFailure, the signon negative cache */
+  GHashTable *signon_failures;
+
+  /* "<account id>/<service name>" of the services with a signon lookup in
+   * progress */
+  GHashTable *signon_in_flight;
+
+  /* Owned SignonAttempts waiting for signond */
+  GHashTable *signon_attempts;
+
+  /* ag_account_store_async() calls in flight */
+  StoreTracker *stores;
+
+  /* Usage data kept across runs */
+  UsageStore *usage;
+
+  /* Setting values read for MC, and the loaded services in lazy mode */
+  AccountCache *cache;
+
+  /* Parameters declared by the connection managers, to only give MC
+   * those of each account's protocol */
+  ProtocolSchemaCache *schemas;
+
+  /* AgAccountId -> startup rank, 1 being announced first */
+  GHashTable *ranks;
+
+  /* Timing of the startup, freed once reported after ready() */
+  StartupProfile *profile;
+
+  /* Names of the accounts the ready() replay could create right away,
+   * announced to MC in rank order at its end; NULL outside of it */
+  GPtrArray *import_batch;
+
+  /* Services are not kept around, nor watched individually; see
+   * LAZY_SERVICES_ENV */
+  gboolean lazy;
+  guint evict_id;
+
+  guint prefetch_id;
+
   gboolean loaded;
   gboolean ready;
 };
 
+/* What is known of a service exposed to MC */
+typedef struct {
+  gchar *account_name;
+  AgAccountId account_id;
+  gchar *service_name;
+  /* Last known ag_account_service_get_enabled() */
+  gboolean enabled;
+  /* Credentials id of its OAuth2 token, 0 if it does not use OAuth2 */
+  guint token_cred_id;
+  /* A token arrived before ready(), possibly after MC read the account */
+  gboolean token_unseen;
+
+  /* Always set unless in lazy mode, where it is created on demand and
+   * dropped once unused for LAZY_SERVICE_IDLE_SECONDS */
+  AgAccountService *service;
+  gint64 last_access;
+  /* Has been written to since the last commit(), so must not be dropped */
+  gboolean dirty;
+
+  /* Parameters of its manager and protocol, owned by the schema cache;
+   * NULL if they are unknown, in which case all settings are given */
+  const ProtocolSchema *schema;
+  gboolean schema_loaded;
+} AccountEntry;
+
+static void
+_account_entry_free (gpointer data)
+{
+  AccountEntry *entry = data;
+
+  tp_clear_object (&entry->service);
+  g_free (entry->account_name);
+  g_free (entry->service_name);
+  g_slice_free (AccountEntry, entry);
+}
+
 typedef enum {
   DELAYED_CREATE,
   DELAYED_DELETE,
@@ -107,9 +263,26 @@ _tp_transform_to_string(GVariant *src)
     {
       return g_variant_dup_string(src, NULL);
     }
+  else if (g_variant_is_of_type (src, G_VARIANT_TYPE_INT32))
+    {
+      return g_strdup_printf ("%d", g_variant_get_int32 (src));
+    }
+  else if (g_variant_is_of_type (src, G_VARIANT_TYPE_UINT32))
+    {
+      return g_strdup_printf ("%u", g_variant_get_uint32 (src));
+    }
+  else if (g_variant_is_of_type (src, G_VARIANT_TYPE_INT64))
+    {
+      return g_strdup_printf ("%" G_GINT64_FORMAT, g_variant_get_int64 (src));
+    }
+  else if (g_variant_is_of_type (src, G_VARIANT_TYPE_UINT64))
+    {
+      return g_strdup_printf ("%" G_GUINT64_FORMAT,
+          g_variant_get_uint64 (src));
+    }
   else
     {
-      DEBUG("VARIANT TYPE: %s", g_variant_get_type_string(src));
+      DEBUG_IFACE ("VARIANT TYPE: %s", g_variant_get_type_string(src));
     }
 
   return NULL;
@@ -121,12 +294,14 @@ _service_dup_tp_value (AgAccountService *service,
 {
   gchar *real_key = g_strdup_printf (KEY_PREFIX "%s", key);
   GVariant *value;
+
+  /* The value is owned by the service */
   value = ag_account_service_get_variant (service, real_key, NULL);
   g_free (real_key);
   if (value == NULL)
     return NULL;
 
-  return g_variant_dup_string(value, NULL);
+  return _tp_transform_to_string (value);
 }
 
 static void
@@ -162,378 +337,1457 @@ _service_set_tp_account_name (AgAccountService *service,
   _service_set_tp_value (service, KEY_ACCOUNT_NAME, account_name);
 }
 
-static void
-_service_enabled_cb (AgAccountService *service,
-    gboolean enabled,
-    McpAccountManagerAccountsSso *self)
+/* Identifies the service independently of the AgAccountService instance,
+ * there may be several of them at a time in lazy mode */
+static gchar *
+_service_dup_key (AgAccountService *service)
 {
-  gchar *account_name = _service_dup_tp_account_name (service);
-  GList *node;
-
-  if (account_name == NULL)
-    {
-      if (enabled)
-        {
-          create_account (service, self);
-
-          node = g_list_find (self->priv->pending_accounts, service);
-          if (node)
-            {
-              self->priv->pending_accounts = g_list_delete_link (self->priv->pending_accounts,
-                  node);
-              g_object_unref (service);
-            }
-        }
-    }
-  else
-    {
-      DEBUG ("Accounts SSO: account %s toggled: %s", account_name,
-          enabled ? "enabled" : "disabled");
+  return g_strdup_printf ("%u/%s",
+      ag_account_service_get_account (service)->id,
+      ag_service_get_name (ag_account_service_get_service (service)));
+}
 
-      /* FIXME: Should this update the username from signon credentials first,
-       * in case that was changed? */
-      g_signal_emit_by_name (self, "toggled", account_name, enabled);
-    }
+static gboolean
+_service_is_querying_signon (McpAccountManagerAccountsSso *self,
+    AgAccountService *service)
+{
+  gchar *key = _service_dup_key (service);
+  gboolean ret = g_hash_table_contains (self->priv->signon_in_flight, key);
 
-  g_free (account_name);
+  g_free (key);
+  return ret;
 }
 
+/* Keeps watching a service until it can be created */
 static void
-_service_changed_cb (AgAccountService *service,
-    McpAccountManagerAccountsSso *self)
+_pending_add (McpAccountManagerAccountsSso *self,
+    AgAccountService *service)
 {
-  gchar *account_name = _service_dup_tp_account_name (service);
-
-  if (!self->priv->ready || account_name == NULL)
+  if (self->priv->lazy)
     return;
 
-  DEBUG ("Accounts SSO: account %s changed", account_name);
-
-  /* FIXME: Should check signon credentials for changed username */
-  /* FIXME: Could use ag_account_service_get_changed_fields()
-   * and emit "altered-one" */
-  g_signal_emit_by_name (self, "altered", account_name);
-
-  g_free (account_name);
+  if (g_list_find (self->priv->pending_accounts, service) == NULL)
+    self->priv->pending_accounts = g_list_prepend (self->priv->pending_accounts,
+        g_object_ref (service));
 }
 
-static void
-_account_stored_cb (GObject *source_object,
-    GAsyncResult *res,
-    gpointer user_data)
+static gboolean
+_lazy_evict_cb (gpointer user_data)
 {
-  AgAccount *account = AG_ACCOUNT(source_object);
-  GError *error = NULL;
+  McpAccountManagerAccountsSso *self = user_data;
+  gint64 idle_since = g_get_monotonic_time () -
+      LAZY_SERVICE_IDLE_SECONDS * G_USEC_PER_SEC;
+  GHashTableIter iter;
+  gpointer value;
+  guint evicted = 0, remaining = 0;
 
-  if (!ag_account_store_finish (account, res, &error))
+  g_hash_table_iter_init (&iter, self->priv->accounts);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
     {
-      g_assert (error != NULL);
-      DEBUG ("Error storing Accounts SSO account '%s': %s",
-          ag_account_get_display_name (account),
-          error->message);
-      g_error_free(error);
+      AccountEntry *entry = value;
+
+      if (entry->service == NULL)
+        continue;
+
+      if (entry->dirty || entry->last_access > idle_since)
+        {
+          remaining++;
+          continue;
+        }
+
+      tp_clear_object (&entry->service);
+      account_cache_set_extra (self->priv->cache, entry->account_name, 0);
+      evicted++;
     }
+
+  sso_counter_add (SSO_COUNTER_SERVICES_EVICTED, evicted);
+  DEBUG_LOAD ("Accounts SSO: dropped %u idle service(s), %u in use", evicted,
+      remaining);
+
+  if (remaining > 0)
+    return G_SOURCE_CONTINUE;
+
+  self->priv->evict_id = 0;
+  return G_SOURCE_REMOVE;
 }
 
+/* Drops the service of an account when the cache needs room, unless it
+ * has changes not committed yet */
 static gboolean
-_add_service (McpAccountManagerAccountsSso *self,
-    AgAccountService *service,
-    const gchar *account_name)
+_cache_evict_cb (const gchar *account_name,
+    gpointer user_data)
 {
-  DEBUG ("Accounts SSO: account %s added", account_name);
+  McpAccountManagerAccountsSso *self = user_data;
+  AccountEntry *entry = g_hash_table_lookup (self->priv->accounts,
+      account_name);
 
-  if (g_hash_table_contains (self->priv->accounts, account_name))
-    {
-      DEBUG ("Already exists, ignoring");
-      return FALSE;
-    }
+  if (!self->priv->lazy || entry == NULL || entry->service == NULL)
+    return TRUE;
 
-  g_hash_table_insert (self->priv->accounts,
-      g_strdup (account_name),
-      g_object_ref (service));
+  if (entry->dirty)
+    return FALSE;
 
+  tp_clear_object (&entry->service);
+  sso_counter_inc (SSO_COUNTER_SERVICES_EVICTED);
   return TRUE;
 }
 
 static void
-_account_create(McpAccountManagerAccountsSso *self, AgAccountService *service)
+_lazy_eviction_schedule (McpAccountManagerAccountsSso *self)
 {
-  AgAccount *account = ag_account_service_get_account (service);
-  gchar *cm_name = _service_dup_tp_value (service, "manager");
-  gchar *protocol_name = _service_dup_tp_value (service, "protocol");
-  gchar *service_name = 0;
-  gchar *account_name = 0;
-  gchar *tmp;
+  if (!self->priv->lazy || self->priv->evict_id != 0)
+    return;
+
+  self->priv->evict_id = g_timeout_add_seconds (LAZY_SERVICE_IDLE_SECONDS,
+      _lazy_evict_cb, self);
+}
 
-  if (tp_str_empty (cm_name) || tp_str_empty (protocol_name))
+/* Returns the service of the entry, creating it if needed, or NULL if its
+ * account or service is gone. */
+static AgAccountService *
+_account_entry_get_service (McpAccountManagerAccountsSso *self,
+    AccountEntry *entry)
+{
+  if (entry->service == NULL)
     {
-      g_debug ("Accounts SSO: _account_create missing manager/protocol for new account %u, ignoring", account->id);
-      g_free (cm_name);
-      g_free (protocol_name);
-      return;
-    }
+      AgAccount *account = ag_manager_get_account (self->priv->manager,
+          entry->account_id);
+      AgService *s;
 
-  /* Generate a unique and predictable name using service name and account ID, instead of
-   * mcp_account_manager_get_unique_name. Manager name and service name are escaped, and
-   * dashes are replaced with underscores in protocol name and service name. This matches
-   * mcp_account_manager_get_unique_name's behavior. */
-  tmp = tp_escape_as_identifier (cm_name);
-  g_free (cm_name);
-  cm_name = tmp;
+      if (account == NULL)
+        return NULL;
 
-  g_strdelimit (protocol_name, "-", '_');
+      s = ag_manager_get_service (self->priv->manager, entry->service_name);
+      if (s == NULL)
+        {
+          g_object_unref (account);
+          return NULL;
+        }
 
-  service_name = tp_escape_as_identifier (ag_service_get_name (ag_account_service_get_service (service)));
-  account_name = g_strdup_printf ("%s/%s/%s_%u", cm_name, protocol_name,
-      service_name, account->id);
+      entry->service = ag_account_service_new (account, s);
+      ag_service_unref (s);
+      g_object_unref (account);
 
-  _service_set_tp_account_name (service, account_name);
-  ag_account_store_async (account, NULL, _account_stored_cb, self);
+      sso_counter_inc (SSO_COUNTER_SERVICES_MATERIALIZED);
+      _lazy_eviction_schedule (self);
+      account_cache_set_extra (self->priv->cache, entry->account_name,
+          LOADED_SERVICE_BYTES);
+    }
 
-  g_debug("Accounts SSO: _account_create: %s", account_name);
+  entry->last_access = g_get_monotonic_time ();
+  return entry->service;
+}
 
-  if (_add_service (self, service, account_name))
-      g_signal_emit_by_name (self, "created", account_name);
+/* Returns the parameters the entry's manager declares for its protocol,
+ * or NULL if they are unknown */
+static const ProtocolSchema *
+_account_entry_get_schema (McpAccountManagerAccountsSso *self,
+    AccountEntry *entry,
+    AgAccountService *service)
+{
+  gchar *cm_name, *protocol_name;
+
+  if (entry->schema_loaded)
+    return entry->schema;
+
+  cm_name = _service_dup_tp_value (service, "manager");
+  protocol_name = _service_dup_tp_value (service, "protocol");
+
+  entry->schema = protocol_schema_cache_lookup (self->priv->schemas,
+      cm_name, protocol_name);
+  entry->schema_loaded = TRUE;
 
   g_free (cm_name);
   g_free (protocol_name);
-  g_free (service_name);
-  g_free (account_name);
+  return entry->schema;
 }
 
-typedef struct
+/* Returns the value of setting key of the account to hand to MC, as its
+ * protocol schema allows, or NULL if MC must not see it */
+static gchar *
+_filter_setting (AccountEntry *entry,
+    const gchar *key,
+    const gchar *value)
 {
-    AgAccount *account;
-    AgAccountService *service;
-    McpAccountManagerAccountsSso *self;
-} AccountCreateData;
+  gchar *filtered;
 
-static void
-_account_created_signon_cb(SignonIdentity *signon,
-    const SignonIdentityInfo *info,
-    const GError *error,
-    gpointer user_data)
-{
-  AccountCreateData *data = (AccountCreateData*) user_data;
-  gchar *username = g_strdup (signon_identity_info_get_username (info));
+  if (value == NULL)
+    return NULL;
 
-  g_debug("Accounts SSO: got account signon info response");
+  /* Our own bookkeeping, which MC has no use for */
+  if (!tp_strdiff (key, KEY_ACCOUNT_NAME) ||
+      !tp_strdiff (key, KEY_READONLY_PARAMS))
+    return NULL;
 
-  if (!tp_str_empty (username))
-    {
-      /* Must be stored for CMs */
-      _service_set_tp_value (data->service, "param-account", username);
-      ag_account_store_async (data->account, NULL, _account_stored_cb, data->self);
+  g_assert (entry->schema_loaded);
 
-      _account_create (data->self, data->service);
-    }
-  else
-    {
-      g_debug("Accounts SSO: has no account name");
-    }
+  filtered = (entry->schema != NULL) ?
+      protocol_schema_filter (entry->schema, key, value) : g_strdup (value);
+  if (filtered == NULL)
+    VERBOSE_IFACE ("Accounts SSO: %s: dropping %s=%s, undeclared "
+        "or mistyped", entry->account_name, key, value);
 
-  g_object_unref (data->service);
-  g_object_unref (signon);
-  g_free(data);
+  return filtered;
 }
 
+/* Hands MC the value of setting key of the account, unset if its protocol
+ * schema rejects it */
 static void
-_account_created_cb (AgManager *manager,
-    AgAccountId id,
-    McpAccountManagerAccountsSso *self)
+_set_setting (const McpAccountManager *am,
+    AccountEntry *entry,
+    const gchar *key,
+    const gchar *value)
 {
-  GList *l;
-  AgAccount *account = ag_manager_get_account (self->priv->manager, id);
+  gchar *filtered = _filter_setting (entry, key, value);
 
-  if (!self->priv->ready)
-    {
-      DelayedSignalData *data = g_slice_new0 (DelayedSignalData);
+  mcp_account_manager_set_value (am, entry->account_name, key, filtered);
+  g_free (filtered);
+}
 
-      data->signal = DELAYED_CREATE;
-      data->account_id = account->id;
+/* Returns the service of a known account, or NULL */
+static AgAccountService *
+_lookup_service (McpAccountManagerAccountsSso *self,
+    const gchar *account_name)
+{
+  AccountEntry *entry = g_hash_table_lookup (self->priv->accounts,
+      account_name);
 
-      g_queue_push_tail (self->priv->pending_signals, data);
-      return;
-    }
+  if (entry == NULL)
+    return NULL;
 
-  l = ag_account_list_services_by_type (account, SERVICE_TYPE);
-  while (l != NULL)
-    {
-      AgAccountService *service = ag_account_service_new (account, l->data);
-      g_signal_connect (service, "enabled",
-          G_CALLBACK (_service_enabled_cb), self);
-      g_signal_connect (service, "changed",
-          G_CALLBACK (_service_changed_cb), self);
+  return _account_entry_get_service (self, entry);
+}
 
-      if (ag_account_get_enabled (account))
-        {
-          create_account (service, self);
-        }
-      else
-        {
-          self->priv->pending_accounts = g_list_prepend (self->priv->pending_accounts,
-              g_object_ref (service));
-        }
+/* Returns the entry of this service of the account, or NULL */
+static AccountEntry *
+_lookup_entry (McpAccountManagerAccountsSso *self,
+    AgAccountId id,
+    const gchar *service_name)
+{
+  GPtrArray *entries = g_hash_table_lookup (self->priv->account_index,
+      GUINT_TO_POINTER (id));
+  guint i;
 
-      g_object_unref (service);
-      ag_service_unref (l->data);
-      l = g_list_delete_link (l, l);
+  for (i = 0; entries != NULL && i < entries->len; i++)
+    {
+      AccountEntry *entry = g_ptr_array_index (entries, i);
+
+      if (!tp_strdiff (entry->service_name, service_name))
+        return entry;
     }
 
-  g_object_unref (account);
+  return NULL;
+}
+
+static AccountEntry *
+_service_lookup_entry (McpAccountManagerAccountsSso *self,
+    AgAccountService *service)
+{
+  return _lookup_entry (self, ag_account_service_get_account (service)->id,
+      ag_service_get_name (ag_account_service_get_service (service)));
 }
 
 static void
-create_account(AgAccountService *service,
+_service_enabled_cb (AgAccountService *service,
+    gboolean enabled,
     McpAccountManagerAccountsSso *self)
 {
-  gchar *account_name = _service_dup_tp_account_name (service);
+  AccountEntry *entry = _service_lookup_entry (self, service);
+  gchar *account_name;
+  GList *node;
 
-  /* If this is the first time we see this service, we have to generate an
-   * account_name for it. */
-  if (account_name == NULL)
+  if (entry != NULL)
     {
-      gchar *username = _service_dup_tp_value(service, "param-account");
-      if (!username)
+      /* Account-wide changes are reported for each of its services */
+      if (entry->enabled == enabled)
         {
-          /* Request auth data to get the username from signon; it's not available
-           * from the account. */
-          AgAuthData *auth_data = ag_account_service_get_auth_data (service);
-          if (!auth_data)
-            {
-              DEBUG("Accounts SSO: account is missing auth data; ignored");
-              return;
-            }
-
-          guint cred_id = ag_auth_data_get_credentials_id (auth_data);
-          ag_auth_data_unref(auth_data);
-
-          SignonIdentity *signon = signon_identity_new_from_db (cred_id);
-          if (!signon)
-            {
-              DEBUG("Accounts SSO: cannot create signon identity from account (cred_id %u); ignored", cred_id);
-              return;
-            }
+          sso_counter_inc (SSO_COUNTER_WAKEUPS_IGNORED);
+          return;
+        }
 
-          /* Callback frees/unrefs data */
-          AccountCreateData *data = g_new(AccountCreateData, 1);
-          data->account = ag_account_service_get_account (service);
-          data->service = g_object_ref (service);
-          data->self = self;
+      account_name = g_strdup (entry->account_name);
+    }
+  else
+    {
+      account_name = _service_dup_tp_account_name (service);
+    }
 
-          DEBUG("Accounts SSO: querying account info from signon");
-          signon_identity_query_info(signon, _account_created_signon_cb, data);
+  if (account_name == NULL)
+    {
+      if (!enabled)
+        {
+          sso_counter_inc (SSO_COUNTER_WAKEUPS_IGNORED);
           return;
         }
-      else
+
+      sso_counter_inc (SSO_COUNTER_WAKEUPS_HANDLED);
+      create_account (service, self);
+
+      /* Keep watching it if it could not be created yet; a failed
+       * signon lookup puts it back */
+      account_name = _service_dup_tp_account_name (service);
+      node = g_list_find (self->priv->pending_accounts, service);
+      if (node && (account_name != NULL ||
+              _service_is_querying_signon (self, service)))
         {
-          _account_create (self, service);
-          g_free (username);
+          self->priv->pending_accounts = g_list_delete_link (self->priv->pending_accounts,
+              node);
+          g_object_unref (service);
         }
     }
   else
     {
-      if (_add_service (self, service, account_name))
-        g_signal_emit_by_name (self, "created", account_name);
+      sso_counter_inc (SSO_COUNTER_WAKEUPS_HANDLED);
+
+      DEBUG_SIGNALS ("Accounts SSO: account %s toggled: %s", account_name,
+          enabled ? "enabled" : "disabled");
+
+      if (entry != NULL)
+        entry->enabled = enabled;
+
+      if (enabled)
+        usage_store_touch (self->priv->usage, account_name);
+
+      /* FIXME: Should this update the username from signon credentials first,
+       * in case that was changed? */
+      g_signal_emit_by_name (self, "toggled", account_name, enabled);
     }
 
   g_free (account_name);
 }
 
 static void
-_account_deleted_cb (AgManager *manager,
-    AgAccountId id,
+_service_changed_cb (AgAccountService *service,
     McpAccountManagerAccountsSso *self)
 {
-  GHashTableIter iter;
-  gpointer value;
-  GList *node;
+  /* Services MC does not know about yet, e.g. pending ones, have no entry;
+   * don't look at their settings */
+  AccountEntry *entry = _service_lookup_entry (self, service);
 
-  if (!self->priv->ready)
+  if (entry != NULL)
     {
-      DelayedSignalData *data = g_slice_new0 (DelayedSignalData);
-
-      data->signal = DELAYED_DELETE;
-      data->account_id = id;
+      account_cache_invalidate (self->priv->cache, entry->account_name);
+      /* The manager or protocol may be what changed */
+      entry->schema_loaded = FALSE;
+      /* Or the user may have logged in again */
+      if (entry->token_cred_id != 0)
+        oauth2_token_cache_retry (self->priv->tokens, entry->token_cred_id);
+    }
 
-      g_queue_push_tail (self->priv->pending_signals, data);
+  if (entry == NULL || !self->priv->ready)
+    {
+      sso_counter_inc (SSO_COUNTER_WAKEUPS_IGNORED);
       return;
     }
 
-  g_hash_table_iter_init (&iter, self->priv->accounts);
-  while (g_hash_table_iter_next (&iter, NULL, &value))
-    {
-      AgAccountService *service = value;
+  sso_counter_inc (SSO_COUNTER_WAKEUPS_HANDLED);
+
+  DEBUG_SIGNALS ("Accounts SSO: account %s changed", entry->account_name);
+
+  /* FIXME: Should check signon credentials for changed username */
+  /* FIXME: Could use ag_account_service_get_changed_fields()
+   * and emit "altered-one" */
+  g_signal_emit_by_name (self, "altered", entry->account_name);
+}
+
+/* Returns TRUE if the service is of one of our service types; all of them
+ * have their Telepathy settings under KEY_PREFIX */
+static gboolean
+_is_ours (McpAccountManagerAccountsSso *self,
+    AgService *s)
+{
+  return g_hash_table_contains (self->priv->service_types,
+      ag_service_get_service_type (s));
+}
+
+static gboolean
+_service_is_ours (McpAccountManagerAccountsSso *self,
+    AgAccountService *service)
+{
+  return _is_ours (self, ag_account_service_get_service (service));
+}
+
+static void
+_service_enabled_traced_cb (AgAccountService *service,
+    gboolean enabled,
+    McpAccountManagerAccountsSso *self)
+{
+  gint64 start = event_trace_begin (self->priv->trace);
+
+  _service_enabled_cb (service, enabled, self);
+
+  event_trace_record (self->priv->trace,
+      enabled ? EVENT_TRACE_SERVICE_ENABLED : EVENT_TRACE_SERVICE_DISABLED,
+      start, ag_account_service_get_account (service)->id,
+      ag_service_get_name (ag_account_service_get_service (service)), NULL);
+}
+
+static void
+_service_changed_traced_cb (AgAccountService *service,
+    McpAccountManagerAccountsSso *self)
+{
+  gint64 start = event_trace_begin (self->priv->trace);
+
+  _service_changed_cb (service, self);
+
+  event_trace_record (self->priv->trace, EVENT_TRACE_SERVICE_CHANGED,
+      start, ag_account_service_get_account (service)->id,
+      ag_service_get_name (ag_account_service_get_service (service)), NULL);
+}
+
+static void
+_service_watch (McpAccountManagerAccountsSso *self,
+    AgAccountService *service)
+{
+  /* The manager signals are routed to the callbacks instead */
+  if (self->priv->lazy)
+    return;
+
+  if (self->priv->trace != NULL)
+    {
+      g_signal_connect (service, "enabled",
+          G_CALLBACK (_service_enabled_traced_cb), self);
+      g_signal_connect (service, "changed",
+          G_CALLBACK (_service_changed_traced_cb), self);
+      return;
+    }
+
+  g_signal_connect (service, "enabled",
+      G_CALLBACK (_service_enabled_cb), self);
+  g_signal_connect (service, "changed",
+      G_CALLBACK (_service_changed_cb), self);
+}
+
+/* Starts keeping an OAuth2 token around for this service if its auth data
+ * uses OAuth2, and returns its credentials id; returns 0 otherwise */
+static guint
+_service_watch_token (McpAccountManagerAccountsSso *self,
+    AgAccountService *service)
+{
+  AgAuthData *auth_data = ag_account_service_get_auth_data (service);
+  guint cred_id = 0;
+
+  if (auth_data == NULL)
+    return 0;
+
+  if (oauth2_auth_data_is_oauth2 (auth_data))
+    {
+      oauth2_token_cache_watch (self->priv->tokens, auth_data);
+      cred_id = ag_auth_data_get_credentials_id (auth_data);
+    }
+
+  ag_auth_data_unref (auth_data);
+  return cred_id;
+}
+
+/* Returns the cached OAuth2 token to be used as password for this account,
+ * or NULL if it does not use OAuth2 or no token is available yet */
+static const gchar *
+_account_peek_token (McpAccountManagerAccountsSso *self,
+    const gchar *account_name)
+{
+  AccountEntry *entry = g_hash_table_lookup (self->priv->accounts,
+      account_name);
+
+  if (entry == NULL || entry->token_cred_id == 0)
+    return NULL;
+
+  return oauth2_token_cache_peek (self->priv->tokens, entry->token_cred_id);
+}
+
+/* Tells MC about the new token of every account using these credentials,
+ * as it only reads the password when loading them or when told to */
+static void
+_token_changed_cb (guint credentials_id,
+    gpointer user_data)
+{
+  McpAccountManagerAccountsSso *self = user_data;
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, self->priv->accounts);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      AccountEntry *entry = value;
+
+      if (entry->token_cred_id != credentials_id)
+        continue;
+
+      /* ready() tells MC then */
+      if (!self->priv->ready)
+        {
+          entry->token_unseen = TRUE;
+          continue;
+        }
+
+      DEBUG_SIGNON ("Accounts SSO: new OAuth2 token for account %s",
+          entry->account_name);
+      g_signal_emit_by_name (self, "altered-one", entry->account_name,
+          KEY_PASSWORD);
+    }
+}
+
+static gboolean
+_add_service (McpAccountManagerAccountsSso *self,
+    AgAccountService *service,
+    const gchar *account_name)
+{
+  AccountEntry *entry;
+  GPtrArray *entries;
+
+  DEBUG_LOAD ("Accounts SSO: account %s added", account_name);
+
+  if (g_hash_table_contains (self->priv->accounts, account_name))
+    {
+      DEBUG_LOAD ("Already exists, ignoring");
+      return FALSE;
+    }
+
+  entry = g_slice_new0 (AccountEntry);
+  entry->account_name = g_strdup (account_name);
+  entry->account_id = ag_account_service_get_account (service)->id;
+  entry->service_name = g_strdup (ag_service_get_name (
+        ag_account_service_get_service (service)));
+  entry->enabled = ag_account_service_get_enabled (service);
+  entry->token_cred_id = _service_watch_token (self, service);
+
+  if (!self->priv->lazy)
+    entry->service = g_object_ref (service);
+
+  g_hash_table_insert (self->priv->accounts, entry->account_name, entry);
+
+  entries = g_hash_table_lookup (self->priv->account_index,
+      GUINT_TO_POINTER (entry->account_id));
+  if (entries == NULL)
+    {
+      entries = g_ptr_array_new ();
+      g_hash_table_insert (self->priv->account_index,
+          GUINT_TO_POINTER (entry->account_id), entries);
+    }
+  g_ptr_array_add (entries, entry);
+
+  return TRUE;
+}
+
+static gint
+_account_name_ptr_compare_rank (gconstpointer a,
+    gconstpointer b,
+    gpointer user_data)
+{
+  return _account_name_compare_rank (*(const gchar * const *) a,
+      *(const gchar * const *) b, user_data);
+}
+
+static void
+_import_batch_flush (McpAccountManagerAccountsSso *self)
+{
+  GPtrArray *batch = self->priv->import_batch;
+  guint i;
+
+  if (batch == NULL)
+    return;
+
+  self->priv->import_batch = NULL;
+
+  DEBUG_LOAD ("Accounts SSO: announcing %u imported account(s)", batch->len);
+
+  /* Accounts created after the load were queued after the ranked ones */
+  g_ptr_array_sort_with_data (batch, _account_name_ptr_compare_rank, self);
+
+  for (i = 0; i < batch->len; i++)
+    {
+      const gchar *account_name = g_ptr_array_index (batch, i);
+
+      /* It may have been deleted in the meantime */
+      if (g_hash_table_contains (self->priv->accounts, account_name))
+        g_signal_emit_by_name (self, "created", account_name);
+    }
+
+  g_ptr_array_unref (batch);
+}
+
+/* Tells MC about a new account, or queues it during the ready() import */
+static void
+_announce_created (McpAccountManagerAccountsSso *self,
+    const gchar *account_name)
+{
+  if (self->priv->import_batch != NULL)
+    g_ptr_array_add (self->priv->import_batch, g_strdup (account_name));
+  else
+    g_signal_emit_by_name (self, "created", account_name);
+}
+
+/* Returns TRUE if the account has been stored */
+static gboolean
+_account_create(McpAccountManagerAccountsSso *self, AgAccountService *service)
+{
+  AgAccount *account = ag_account_service_get_account (service);
+  gchar *cm_name = _service_dup_tp_value (service, "manager");
+  gchar *protocol_name = _service_dup_tp_value (service, "protocol");
+  gchar *account_name;
+
+  account_name = account_name_build (cm_name, protocol_name,
+      ag_service_get_name (ag_account_service_get_service (service)),
+      account->id);
+  g_free (cm_name);
+  g_free (protocol_name);
+
+  if (account_name == NULL)
+    {
+      DEBUG_LOAD ("Accounts SSO: _account_create missing manager/protocol for new account %u, ignoring", account->id);
+      return FALSE;
+    }
+
+  _service_set_tp_account_name (service, account_name);
+  store_tracker_store (self->priv->stores, account);
+
+  DEBUG_LOAD ("Accounts SSO: _account_create: %s", account_name);
+
+  if (_add_service (self, service, account_name))
+    _announce_created (self, account_name);
+
+  g_free (account_name);
+  return TRUE;
+}
+
+typedef struct
+{
+    AgAccount *account;
+    AgAccountService *service;
+    McpAccountManagerAccountsSso *self;
+    guint cred_id;
+    guint attempt;
+    gint64 profile_start;
+} AccountCreateData;
+
+/* A single signon_identity_query_info() call */
+typedef struct
+{
+    AccountCreateData *data;
+    SignonIdentity *signon;
+    guint timeout_id;
+} SignonAttempt;
+
+/* Data of the identity pointing at its attempt; it is cleared when the
+ * attempt is freed, e.g. when it times out, so a late reply finds nothing
+ * and is dropped */
+#define SIGNON_ATTEMPT_KEY "mcp-accounts-sso-attempt"
+
+/* Negative cache entry of an identity whose lookups failed */
+typedef struct
+{
+    guint failures;
+    /* Monotonic time before which it is not queried again */
+    gint64 retry_after;
+} SignonFailure;
+
+static void _signon_query_start (AccountCreateData *data);
+
+/* Reports the startup profile once ready() and the work it started are
+ * done */
+static void
+_startup_profile_check (McpAccountManagerAccountsSso *self)
+{
+  if (!startup_profile_is_complete (self->priv->profile))
+    return;
+
+  startup_profile_report (self->priv->profile);
+  tp_clear_pointer (&self->priv->profile, startup_profile_free);
+  sso_counters_log ("startup");
+  store_tracker_log_stats (self->priv->stores);
+  account_cache_log_stats (self->priv->cache);
+}
+
+static gboolean
+_signon_lookup_is_blocked (McpAccountManagerAccountsSso *self,
+    guint cred_id)
+{
+  SignonFailure *failure = g_hash_table_lookup (self->priv->signon_failures,
+      GUINT_TO_POINTER (cred_id));
+
+  return failure != NULL && g_get_monotonic_time () < failure->retry_after;
+}
+
+static void
+_signon_lookup_failed (McpAccountManagerAccountsSso *self,
+    guint cred_id)
+{
+  SignonFailure *failure = g_hash_table_lookup (self->priv->signon_failures,
+      GUINT_TO_POINTER (cred_id));
+  gint64 delay;
+
+  if (failure == NULL)
+    {
+      failure = g_slice_new0 (SignonFailure);
+      g_hash_table_insert (self->priv->signon_failures,
+          GUINT_TO_POINTER (cred_id), failure);
+    }
+
+  failure->failures++;
+  delay = MIN ((gint64) SIGNON_FAILURE_BASE_SECONDS << MIN (failure->failures - 1, 16),
+      SIGNON_FAILURE_MAX_SECONDS);
+  failure->retry_after = g_get_monotonic_time () + delay * G_USEC_PER_SEC;
+
+  DEBUG_SIGNON ("Accounts SSO: signon lookups for cred_id %u failed %u time(s), "
+      "not retrying for %" G_GINT64_FORMAT "s", cred_id, failure->failures,
+      delay);
+}
+
+static void
+_signon_failure_free (gpointer data)
+{
+  g_slice_free (SignonFailure, data);
+}
+
+/* Releases everything the lookup held, once it succeeded or gave up */
+static void
+_account_create_data_finish (AccountCreateData *data)
+{
+  McpAccountManagerAccountsSso *self = data->self;
+
+  if (self->priv->signon_in_flight != NULL)
+    {
+      gchar *key = _service_dup_key (data->service);
+
+      g_hash_table_remove (self->priv->signon_in_flight, key);
+      g_free (key);
+    }
+
+  if (data->profile_start != 0)
+    {
+      startup_profile_end (self->priv->profile, STARTUP_PROFILE_SIGNON,
+          "signon-query", data->account->id, data->profile_start);
+      startup_profile_release (self->priv->profile);
+      _startup_profile_check (self);
+    }
+
+  g_object_unref (data->service);
+  g_object_unref (data->account);
+  g_object_unref (data->self);
+  g_free(data);
+}
+
+static gboolean
+_signon_query_retry_cb (gpointer user_data)
+{
+  AccountCreateData *data = user_data;
+
+  if (data->self->priv->manager == NULL)
+    _account_create_data_finish (data);
+  else
+    _signon_query_start (data);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Retries transient failures with exponential backoff, and gives up on the
+ * others or once out of attempts */
+static void
+_signon_query_failed (AccountCreateData *data,
+    gboolean transient)
+{
+  McpAccountManagerAccountsSso *self = data->self;
+
+  if (transient && data->attempt < SIGNON_MAX_ATTEMPTS &&
+      self->priv->manager != NULL)
+    {
+      guint delay = SIGNON_RETRY_BASE_SECONDS << (data->attempt - 1);
+
+      DEBUG_SIGNON ("Accounts SSO: retrying signon query for account %u in %us",
+          data->account->id, delay);
+      sso_counter_inc (SSO_COUNTER_SIGNON_RETRIES);
+      g_timeout_add_seconds (delay, _signon_query_retry_cb, data);
+      return;
+    }
+
+  sso_counter_inc (SSO_COUNTER_SIGNON_FAILURES);
+
+  if (self->priv->manager != NULL)
+    {
+      _signon_lookup_failed (self, data->cred_id);
+
+      /* Keep watching it, so enabling it again gives it another chance
+       * once the identity is not blocked anymore */
+      _pending_add (self, data->service);
+    }
+
+  _account_create_data_finish (data);
+}
+
+static void
+_signon_attempt_free (gpointer user_data)
+{
+  SignonAttempt *attempt = user_data;
+
+  if (attempt->timeout_id != 0)
+    g_source_remove (attempt->timeout_id);
+  g_object_set_data (G_OBJECT (attempt->signon), SIGNON_ATTEMPT_KEY, NULL);
+  g_object_unref (attempt->signon);
+  g_slice_free (SignonAttempt, attempt);
+}
+
+static gboolean
+_signon_query_timeout_cb (gpointer user_data)
+{
+  SignonAttempt *attempt = user_data;
+  AccountCreateData *data = attempt->data;
+
+  DEBUG_SIGNON ("Accounts SSO: signon query for account %u timed out",
+      data->account->id);
+  sso_counter_inc (SSO_COUNTER_SIGNON_TIMEOUTS);
+
+  /* signond may never reply; give up on the identity now */
+  attempt->timeout_id = 0;
+  g_hash_table_remove (data->self->priv->signon_attempts, attempt);
+
+  _signon_query_failed (data, TRUE);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+_account_created_signon_cb(SignonIdentity *signon,
+    const SignonIdentityInfo *info,
+    const GError *error,
+    gpointer user_data)
+{
+  SignonAttempt *attempt;
+  AccountCreateData *data;
+  gchar *username = NULL;
+  gint64 start;
+
+  attempt = g_object_get_data (G_OBJECT (signon), SIGNON_ATTEMPT_KEY);
+  if (attempt == NULL)
+    {
+      DEBUG_SIGNON ("Accounts SSO: dropping signon info response after timeout");
+      return;
+    }
+
+  data = attempt->data;
+  g_hash_table_remove (data->self->priv->signon_attempts, attempt);
+
+  start = event_trace_begin (data->self->priv->trace);
+
+  DEBUG_SIGNON ("Accounts SSO: got account signon info response");
+
+  if (error != NULL)
+    DEBUG_SIGNON ("Accounts SSO: signon query for account %u failed: %s",
+        data->account->id, error->message);
+  else if (info != NULL)
+    username = g_strdup (signon_identity_info_get_username (info));
+
+  event_trace_record (data->self->priv->trace, EVENT_TRACE_SIGNON_INFO,
+      start, data->account->id, NULL,
+      tp_str_empty (username) ? "no-username" : NULL);
+
+  if (data->self->priv->manager == NULL)
+    {
+      /* The plugin has been disposed meanwhile */
+      _account_create_data_finish (data);
+    }
+  else if (error != NULL)
+    {
+      _signon_query_failed (data, TRUE);
+    }
+  else if (tp_str_empty (username))
+    {
+      DEBUG_SIGNON ("Accounts SSO: has no account name");
+      /* Asking again won't give it one */
+      _signon_query_failed (data, FALSE);
+    }
+  else
+    {
+      g_hash_table_remove (data->self->priv->signon_failures,
+          GUINT_TO_POINTER (data->cred_id));
+
+      /* Must be stored for CMs; that's done along with the account name
+       * unless the account cannot be created */
+      _service_set_tp_value (data->service, "param-account", username);
+
+      if (!_account_create (data->self, data->service))
+        store_tracker_store (data->self->priv->stores, data->account);
+
+      _account_create_data_finish (data);
+    }
+
+  g_free (username);
+}
+
+static void
+_signon_query_start (AccountCreateData *data)
+{
+  SignonIdentity *signon;
+  SignonAttempt *attempt;
+
+  data->attempt++;
+  sso_counter_inc (SSO_COUNTER_SIGNON_QUERIES);
+
+  signon = signon_identity_new_from_db (data->cred_id);
+  if (!signon)
+    {
+      DEBUG_SIGNON ("Accounts SSO: cannot create signon identity from account (cred_id %u); ignored", data->cred_id);
+      _signon_query_failed (data, FALSE);
+      return;
+    }
+
+  /* Whichever of the reply and the timeout comes first frees attempt and
+   * signon */
+  attempt = g_slice_new0 (SignonAttempt);
+  attempt->data = data;
+  attempt->signon = signon;
+  attempt->timeout_id = g_timeout_add_seconds (SIGNON_QUERY_TIMEOUT_SECONDS,
+      _signon_query_timeout_cb, attempt);
+  g_object_set_data (G_OBJECT (signon), SIGNON_ATTEMPT_KEY, attempt);
+  g_hash_table_add (data->self->priv->signon_attempts, attempt);
+
+  DEBUG_SIGNON ("Accounts SSO: querying account info from signon (attempt %u)",
+      data->attempt);
+  signon_identity_query_info(signon, _account_created_signon_cb, NULL);
+}
+
+static void
+_account_created_cb (AgManager *manager,
+    AgAccountId id,
+    McpAccountManagerAccountsSso *self)
+{
+  GList *l;
+  AgAccount *account;
+  gboolean owned = FALSE;
+
+  if (!self->priv->ready)
+    {
+      DelayedSignalData *data = g_slice_new0 (DelayedSignalData);
+
+      data->signal = DELAYED_CREATE;
+      data->account_id = id;
+
+      g_queue_push_tail (self->priv->pending_signals, data);
+      return;
+    }
+
+  /* It may already be gone when replaying delayed signals */
+  account = ag_manager_get_account (self->priv->manager, id);
+  if (account == NULL)
+    {
+      sso_counter_inc (SSO_COUNTER_WAKEUPS_IGNORED);
+      return;
+    }
+
+  l = ag_account_list_services (account);
+  while (l != NULL)
+    {
+      /* Services of other types are not ours, don't even load them */
+      if (_is_ours (self, l->data))
+        {
+          AgAccountService *service = ag_account_service_new (account,
+              l->data);
+
+          owned = TRUE;
+          _service_watch (self, service);
+
+          if (ag_account_get_enabled (account))
+            {
+              create_account (service, self);
+            }
+          else
+            {
+              _pending_add (self, service);
+            }
+
+          g_object_unref (service);
+        }
+
+      ag_service_unref (l->data);
+      l = g_list_delete_link (l, l);
+    }
+
+  sso_counter_inc (owned ? SSO_COUNTER_WAKEUPS_HANDLED :
+      SSO_COUNTER_WAKEUPS_IGNORED);
+  g_object_unref (account);
+}
+
+static void
+create_account(AgAccountService *service,
+    McpAccountManagerAccountsSso *self)
+{
+  gchar *account_name = _service_dup_tp_account_name (service);
+
+  /* If this is the first time we see this service, we have to generate an
+   * account_name for it. */
+  if (account_name == NULL)
+    {
+      gchar *username = _service_dup_tp_value(service, "param-account");
+      if (!username)
+        {
+          /* Request auth data to get the username from signon; it's not available
+           * from the account. */
+          AgAuthData *auth_data = ag_account_service_get_auth_data (service);
+          if (!auth_data)
+            {
+              DEBUG_SIGNON ("Accounts SSO: account is missing auth data; ignored");
+              return;
+            }
+
+          guint cred_id = ag_auth_data_get_credentials_id (auth_data);
+          ag_auth_data_unref(auth_data);
+
+          if (_service_is_querying_signon (self, service))
+            {
+              DEBUG_SIGNON ("Accounts SSO: already querying signon for this account");
+              return;
+            }
+
+          if (_signon_lookup_is_blocked (self, cred_id))
+            {
+              DEBUG_SIGNON ("Accounts SSO: signon lookups for cred_id %u keep failing; ignored", cred_id);
+              sso_counter_inc (SSO_COUNTER_SIGNON_NEGATIVE_HITS);
+              return;
+            }
+
+          /* _account_create_data_finish() frees/unrefs data */
+          AccountCreateData *data = g_new0(AccountCreateData, 1);
+          data->account = g_object_ref (ag_account_service_get_account (service));
+          data->service = g_object_ref (service);
+          data->self = g_object_ref (self);
+          data->cred_id = cred_id;
+          data->profile_start = startup_profile_begin (self->priv->profile);
+          startup_profile_hold (self->priv->profile);
+
+          g_hash_table_add (self->priv->signon_in_flight,
+              _service_dup_key (service));
+          _signon_query_start (data);
+          return;
+        }
+      else
+        {
+          _account_create (self, service);
+          g_free (username);
+        }
+    }
+  else
+    {
+      if (_add_service (self, service, account_name))
+        _announce_created (self, account_name);
+    }
+
+  g_free (account_name);
+}
+
+static void
+_account_deleted_cb (AgManager *manager,
+    AgAccountId id,
+    McpAccountManagerAccountsSso *self)
+{
+  GPtrArray *entries;
+  gboolean handled = FALSE;
+  GList *node;
+  guint i;
+
+  if (!self->priv->ready)
+    {
+      DelayedSignalData *data = g_slice_new0 (DelayedSignalData);
+
+      data->signal = DELAYED_DELETE;
+      data->account_id = id;
+
+      g_queue_push_tail (self->priv->pending_signals, data);
+      return;
+    }
+
+  entries = g_hash_table_lookup (self->priv->account_index,
+      GUINT_TO_POINTER (id));
+  if (entries != NULL)
+    {
+      handled = TRUE;
+      g_hash_table_steal (self->priv->account_index, GUINT_TO_POINTER (id));
+    }
+
+  for (i = 0; entries != NULL && i < entries->len; i++)
+    {
+      AccountEntry *entry = g_ptr_array_index (entries, i);
+      /* The name goes away with the entry */
+      gchar *account_name = g_strdup (entry->account_name);
+
+      DEBUG_SIGNALS ("Accounts SSO: account %s deleted", account_name);
+
+      if (entry->token_cred_id != 0)
+        oauth2_token_cache_unwatch (self->priv->tokens, entry->token_cred_id);
+      usage_store_forget (self->priv->usage, account_name);
+      account_cache_remove (self->priv->cache, account_name);
+      g_hash_table_remove (self->priv->accounts, account_name);
+      g_signal_emit_by_name (self, "deleted", account_name);
+
+      g_free (account_name);
+    }
+
+  if (entries != NULL)
+    g_ptr_array_unref (entries);
+
+  node = self->priv->pending_accounts;
+  while (node)
+    {
+      GList *next = g_list_next (node);
+      AgAccountService *service = node->data;
       AgAccount *account = ag_account_service_get_account (service);
-      gchar *account_name;
 
-      if (account->id != id)
-        continue;
+      if (account->id == id)
+        {
+          handled = TRUE;
+          g_object_unref (service);
+          self->priv->pending_accounts = g_list_delete_link (self->priv->pending_accounts, node);
+        }
+
+      node = next;
+    }
+
+  sso_counter_inc (handled ? SSO_COUNTER_WAKEUPS_HANDLED :
+      SSO_COUNTER_WAKEUPS_IGNORED);
+}
+
+static void
+_account_created_traced_cb (AgManager *manager,
+    AgAccountId id,
+    McpAccountManagerAccountsSso *self)
+{
+  gint64 start = event_trace_begin (self->priv->trace);
+
+  _account_created_cb (manager, id, self);
+
+  event_trace_record (self->priv->trace, EVENT_TRACE_ACCOUNT_CREATED,
+      start, id, NULL, NULL);
+}
+
+static void
+_account_deleted_traced_cb (AgManager *manager,
+    AgAccountId id,
+    McpAccountManagerAccountsSso *self)
+{
+  gint64 start = event_trace_begin (self->priv->trace);
+
+  _account_deleted_cb (manager, id, self);
 
-      account_name = _service_dup_tp_account_name (service);
-      if (account_name == NULL)
-        continue;
+  event_trace_record (self->priv->trace, EVENT_TRACE_ACCOUNT_DELETED,
+      start, id, NULL, NULL);
+}
 
-      DEBUG ("Accounts SSO: account %s deleted", account_name);
+/* In lazy mode, hands the changes of an account to the callbacks of its
+ * services, as their own "enabled" and "changed" signals would have. */
+static void
+_lazy_account_changed (McpAccountManagerAccountsSso *self,
+    AgAccountId id,
+    gboolean enabled_only)
+{
+  AgAccount *account;
+  gboolean known;
+  GList *l;
 
-      g_hash_table_iter_remove (&iter);
-      g_signal_emit_by_name (self, "deleted", account_name);
+  /* Services are only watched once loaded */
+  if (!self->priv->loaded)
+    return;
 
-      g_free (account_name);
+  /* Only enabling an account can make it ours */
+  known = g_hash_table_contains (self->priv->account_index,
+      GUINT_TO_POINTER (id));
+  if (!known && !enabled_only)
+    {
+      sso_counter_inc (SSO_COUNTER_WAKEUPS_IGNORED);
+      return;
     }
 
-  node = self->priv->pending_accounts;
-  while (node)
+  account = ag_manager_get_account (self->priv->manager, id);
+  if (account == NULL)
+    return;
+
+  if (!known && !ag_account_get_enabled (account))
     {
-      GList *next = g_list_next (node);
-      AgAccountService *service = node->data;
-      AgAccount *account = ag_account_service_get_account (service);
+      sso_counter_inc (SSO_COUNTER_WAKEUPS_IGNORED);
+      g_object_unref (account);
+      return;
+    }
 
-      if (account->id == id)
+  l = ag_account_list_services (account);
+  while (l != NULL)
+    {
+      if (_is_ours (self, l->data))
         {
+          AgAccountService *service = ag_account_service_new (account,
+              l->data);
+          AccountEntry *entry = _lookup_entry (self, id,
+              ag_service_get_name (l->data));
+          gboolean enabled = ag_account_service_get_enabled (service);
+
+          if (entry == NULL && !self->priv->ready)
+            {
+              /* Like _account_created_cb(), MC hears of it once ready;
+               * the replay handles each account once */
+              DelayedSignalData *data = g_slice_new0 (DelayedSignalData);
+
+              data->signal = DELAYED_CREATE;
+              data->account_id = id;
+
+              g_queue_push_tail (self->priv->pending_signals, data);
+            }
+          else if (entry == NULL || entry->enabled != enabled)
+            {
+              if (self->priv->trace != NULL)
+                _service_enabled_traced_cb (service, enabled, self);
+              else
+                _service_enabled_cb (service, enabled, self);
+            }
+          else if (!enabled_only)
+            {
+              if (self->priv->trace != NULL)
+                _service_changed_traced_cb (service, self);
+              else
+                _service_changed_cb (service, self);
+            }
+          else
+            {
+              sso_counter_inc (SSO_COUNTER_WAKEUPS_IGNORED);
+            }
+
           g_object_unref (service);
-          self->priv->pending_accounts = g_list_delete_link (self->priv->pending_accounts, node);
         }
 
-      node = next;
+      ag_service_unref (l->data);
+      l = g_list_delete_link (l, l);
     }
+
+  g_object_unref (account);
+}
+
+static void
+_lazy_enabled_event_cb (AgManager *manager,
+    AgAccountId id,
+    McpAccountManagerAccountsSso *self)
+{
+  _lazy_account_changed (self, id, TRUE);
+}
+
+static void
+_lazy_account_updated_cb (AgManager *manager,
+    AgAccountId id,
+    McpAccountManagerAccountsSso *self)
+{
+  _lazy_account_changed (self, id, FALSE);
 }
 
 static void
 mcp_account_manager_accounts_sso_dispose (GObject *object)
 {
   McpAccountManagerAccountsSso *self = (McpAccountManagerAccountsSso *) object;
+  GHashTableIter iter;
+  gpointer value;
+  GList *l;
+
+  /* Give up on the signon queries still waiting, with their identities */
+  if (self->priv->signon_attempts != NULL)
+    {
+      g_hash_table_iter_init (&iter, self->priv->signon_attempts);
+      while (g_hash_table_iter_next (&iter, &value, NULL))
+        {
+          AccountCreateData *data = ((SignonAttempt *) value)->data;
+
+          g_hash_table_iter_remove (&iter);
+          _account_create_data_finish (data);
+        }
+
+      tp_clear_pointer (&self->priv->signon_attempts, g_hash_table_unref);
+    }
+
+  /* Don't lose writes on shutdown, nor race with the next load */
+  if (self->priv->stores != NULL)
+    {
+      store_tracker_flush (self->priv->stores, DISPOSE_FLUSH_TIMEOUT_MS);
+      store_tracker_log_stats (self->priv->stores);
+      tp_clear_pointer (&self->priv->stores, store_tracker_unref);
+    }
+
+  /* Services may outlive us, e.g. while a signon query holds them */
+  if (self->priv->accounts != NULL)
+    {
+      g_hash_table_iter_init (&iter, self->priv->accounts);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+          AccountEntry *entry = value;
+
+          if (entry->service != NULL)
+            g_signal_handlers_disconnect_by_data (entry->service, self);
+        }
+    }
+
+  if (self->priv->evict_id != 0)
+    {
+      g_source_remove (self->priv->evict_id);
+      self->priv->evict_id = 0;
+    }
+
+  if (self->priv->prefetch_id != 0)
+    {
+      g_source_remove (self->priv->prefetch_id);
+      self->priv->prefetch_id = 0;
+    }
+
+  for (l = self->priv->pending_accounts; l != NULL; l = l->next)
+    g_signal_handlers_disconnect_by_data (l->data, self);
+
+  if (self->priv->manager != NULL)
+    g_signal_handlers_disconnect_by_data (self->priv->manager, self);
 
   tp_clear_object (&self->priv->am);
+
+  tp_clear_pointer (&self->priv->import_batch, g_ptr_array_unref);
   tp_clear_object (&self->priv->manager);
+  tp_clear_pointer (&self->priv->service_types, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->provider_services, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->ranks, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->signon_failures, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->signon_in_flight, g_hash_table_unref);
+
+  if (self->priv->usage != NULL)
+    {
+      usage_store_flush (self->priv->usage);
+      tp_clear_pointer (&self->priv->usage, usage_store_free);
+    }
+  tp_clear_pointer (&self->priv->account_index, g_hash_table_unref);
   tp_clear_pointer (&self->priv->accounts, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->tokens, oauth2_token_cache_free);
+  tp_clear_pointer (&self->priv->trace, event_trace_close);
+
+  /* Whatever we got so far, e.g. if ready() never came */
+  startup_profile_report (self->priv->profile);
+  tp_clear_pointer (&self->priv->profile, startup_profile_free);
+  sso_counters_log ("dispose");
+  account_cache_log_stats (self->priv->cache);
+  tp_clear_pointer (&self->priv->cache, account_cache_free);
+  tp_clear_pointer (&self->priv->schemas, protocol_schema_cache_free);
+  sso_log_flush ();
 
   g_list_free_full (self->priv->pending_accounts, g_object_unref);
   self->priv->pending_accounts = NULL;
 
+  if (self->priv->pending_signals != NULL)
+    {
+      DelayedSignalData *data;
+
+      while ((data = g_queue_pop_head (self->priv->pending_signals)) != NULL)
+        g_slice_free (DelayedSignalData, data);
+
+      g_queue_free (self->priv->pending_signals);
+      self->priv->pending_signals = NULL;
+    }
+
   G_OBJECT_CLASS (mcp_account_manager_accounts_sso_parent_class)->dispose (object);
 }
 
 static void
 mcp_account_manager_accounts_sso_init (McpAccountManagerAccountsSso *self)
 {
-  DEBUG ("Accounts SSO: MC plugin initialised");
+  const gchar *types_env, *budget_env;
+  gchar **types;
+  guint i;
+  gint64 init_start, start;
+
+  sso_log_init ();
+  DEBUG_LOAD ("Accounts SSO: MC plugin initialised");
 
   self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
       MCP_TYPE_ACCOUNT_MANAGER_ACCOUNTS_SSO, McpAccountManagerAccountsSsoPrivate);
 
+  self->priv->profile = startup_profile_new ();
+  init_start = startup_profile_begin (self->priv->profile);
+
+  self->priv->lazy = !tp_strdiff (g_getenv (LAZY_SERVICES_ENV), "1");
   self->priv->accounts = g_hash_table_new_full (g_str_hash, g_str_equal,
-      g_free, g_object_unref);
+      NULL, _account_entry_free);
+  self->priv->account_index = g_hash_table_new_full (g_direct_hash,
+      g_direct_equal, NULL, (GDestroyNotify) g_ptr_array_unref);
   self->priv->pending_accounts = NULL;
   self->priv->pending_signals = g_queue_new ();
+  self->priv->tokens = oauth2_token_cache_new (_token_changed_cb, self);
+  self->priv->trace = event_trace_open_from_env ();
+  _load_provider_services (self);
+  self->priv->usage = usage_store_load ();
+  self->priv->stores = store_tracker_new ();
+
+  budget_env = g_getenv (CACHE_BUDGET_ENV);
+  self->priv->cache = account_cache_new (tp_str_empty (budget_env) ?
+      DEFAULT_CACHE_BUDGET : g_ascii_strtoull (budget_env, NULL, 10),
+      _cache_evict_cb, self);
+  self->priv->schemas = protocol_schema_cache_new ();
+  self->priv->ranks = g_hash_table_new (g_direct_hash, g_direct_equal);
+  self->priv->signon_failures = g_hash_table_new_full (g_direct_hash,
+      g_direct_equal, NULL, _signon_failure_free);
+  self->priv->signon_in_flight = g_hash_table_new_full (g_str_hash,
+      g_str_equal, g_free, NULL);
+  self->priv->signon_attempts = g_hash_table_new_full (g_direct_hash,
+      g_direct_equal, _signon_attempt_free, NULL);
+
+  self->priv->service_types = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
+
+  types_env = g_getenv (SERVICE_TYPES_ENV);
+  types = g_strsplit (tp_str_empty (types_env) ? DEFAULT_SERVICE_TYPES : types_env,
+      ":", -1);
+  for (i = 0; types[i] != NULL; i++)
+    {
+      if (types[i][0] != '\0')
+        g_hash_table_add (self->priv->service_types, g_strdup (types[i]));
+    }
+  g_strfreev (types);
+
+  if (g_hash_table_size (self->priv->service_types) == 0)
+    g_hash_table_add (self->priv->service_types,
+        g_strdup (DEFAULT_SERVICE_TYPES));
+
+  /* A single manager serves all service types; when there is only one,
+   * let libaccounts do the filtering. */
+  start = startup_profile_begin (self->priv->profile);
+  if (g_hash_table_size (self->priv->service_types) == 1)
+    {
+      GList *keys = g_hash_table_get_keys (self->priv->service_types);
 
-  self->priv->manager = ag_manager_new_for_service_type (SERVICE_TYPE);
+      self->priv->manager = ag_manager_new_for_service_type (keys->data);
+      g_list_free (keys);
+    }
+  else
+    {
+      self->priv->manager = ag_manager_new ();
+    }
+  startup_profile_end (self->priv->profile, STARTUP_PROFILE_PHASE,
+      "ag_manager_new", 0, start);
   g_return_if_fail (self->priv->manager != NULL);
 
-  g_signal_connect (self->priv->manager, "account-created",
-      G_CALLBACK (_account_created_cb), self);
-  g_signal_connect (self->priv->manager, "account-deleted",
-      G_CALLBACK (_account_deleted_cb), self);
+  DEBUG_LOAD ("Accounts SSO: watching %u service type(s)",
+      g_hash_table_size (self->priv->service_types));
+
+  if (self->priv->trace != NULL)
+    {
+      g_signal_connect (self->priv->manager, "account-created",
+          G_CALLBACK (_account_created_traced_cb), self);
+      g_signal_connect (self->priv->manager, "account-deleted",
+          G_CALLBACK (_account_deleted_traced_cb), self);
+    }
+  else
+    {
+      g_signal_connect (self->priv->manager, "account-created",
+          G_CALLBACK (_account_created_cb), self);
+      g_signal_connect (self->priv->manager, "account-deleted",
+          G_CALLBACK (_account_deleted_cb), self);
+    }
+
+  if (self->priv->lazy)
+    {
+      DEBUG_LOAD ("Accounts SSO: services are loaded on demand");
+
+      g_signal_connect (self->priv->manager, "enabled-event",
+          G_CALLBACK (_lazy_enabled_event_cb), self);
+      g_signal_connect (self->priv->manager, "account-updated",
+          G_CALLBACK (_lazy_account_updated_cb), self);
+    }
+
+  startup_profile_end (self->priv->profile, STARTUP_PROFILE_PHASE, "init",
+      0, init_start);
 }
 
 static void
@@ -543,14 +1797,90 @@ mcp_account_manager_accounts_sso_class_init (McpAccountManagerAccountsSsoClass *
 
   gobject_class->dispose = mcp_account_manager_accounts_sso_dispose;
 
+  _special_keys_init ();
+
   g_type_class_add_private (gobject_class,
       sizeof (McpAccountManagerAccountsSsoPrivate));
 }
 
+/* Services are loaded, replayed and announced at startup in this order:
+ * enabled ones first, then those connecting automatically, then the most
+ * recently used ones. */
+typedef struct {
+  AgAccountService *service;
+  gchar *account_name;
+  gboolean enabled;
+  gboolean auto_connect;
+  gint64 last_used;
+} RankedService;
+
+static gint
+_ranked_service_compare (gconstpointer a,
+    gconstpointer b)
+{
+  const RankedService *ra = *(RankedService * const *) a;
+  const RankedService *rb = *(RankedService * const *) b;
+
+  if (ra->enabled != rb->enabled)
+    return ra->enabled ? -1 : 1;
+
+  if (ra->auto_connect != rb->auto_connect)
+    return ra->auto_connect ? -1 : 1;
+
+  if (ra->last_used != rb->last_used)
+    return ra->last_used > rb->last_used ? -1 : 1;
+
+  return (gint) ag_account_service_get_account (ra->service)->id -
+      (gint) ag_account_service_get_account (rb->service)->id;
+}
+
+static void
+_ranked_service_free (gpointer data)
+{
+  RankedService *ranked = data;
+
+  g_object_unref (ranked->service);
+  g_free (ranked->account_name);
+  g_slice_free (RankedService, ranked);
+}
+
+/* Returns the startup rank of the account, G_MAXUINT if it has none */
+static guint
+_account_get_rank (McpAccountManagerAccountsSso *self,
+    AgAccountId id)
+{
+  gpointer rank;
+
+  if (!g_hash_table_lookup_extended (self->priv->ranks, GUINT_TO_POINTER (id),
+          NULL, &rank))
+    return G_MAXUINT;
+
+  return GPOINTER_TO_UINT (rank);
+}
+
+static gint
+_account_name_compare_rank (gconstpointer a,
+    gconstpointer b,
+    gpointer user_data)
+{
+  McpAccountManagerAccountsSso *self = user_data;
+  AccountEntry *ea = g_hash_table_lookup (self->priv->accounts, a);
+  AccountEntry *eb = g_hash_table_lookup (self->priv->accounts, b);
+  guint ra, rb;
+
+  ra = (ea != NULL) ? _account_get_rank (self, ea->account_id) : G_MAXUINT;
+  rb = (eb != NULL) ? _account_get_rank (self, eb->account_id) : G_MAXUINT;
+
+  return (ra > rb) - (ra < rb);
+}
+
 static void
 _ensure_loaded (McpAccountManagerAccountsSso *self)
 {
   GList *services;
+  GPtrArray *ranked;
+  gint64 load_start;
+  guint i;
 
   if (self->priv->loaded)
     return;
@@ -559,22 +1889,62 @@ _ensure_loaded (McpAccountManagerAccountsSso *self)
 
   g_assert (!self->priv->ready);
 
+  load_start = startup_profile_begin (self->priv->profile);
+
+  ranked = g_ptr_array_new_with_free_func (_ranked_service_free);
+
   services = ag_manager_get_account_services (self->priv->manager);
   while (services != NULL)
     {
       AgAccountService *service = services->data;
-      AgAccount *account = ag_account_service_get_account (service);
-      gchar *account_name = _service_dup_tp_account_name (service);
+      if (_service_is_ours (self, service))
+        {
+          RankedService *r = g_slice_new0 (RankedService);
+          gchar *auto_connect;
+
+          r->service = g_object_ref (service);
+          r->account_name = _service_dup_tp_account_name (service);
+          r->enabled = ag_account_service_get_enabled (service);
+
+          auto_connect = _service_dup_tp_value (service, "ConnectAutomatically");
+          r->auto_connect = !tp_strdiff (auto_connect, "true");
+          g_free (auto_connect);
+
+          if (r->account_name != NULL)
+            r->last_used = usage_store_get_last_used (self->priv->usage,
+                r->account_name);
+
+          g_ptr_array_add (ranked, r);
+        }
+
+      g_object_unref (services->data);
+      services = g_list_delete_link (services, services);
+    }
+
+  g_ptr_array_sort (ranked, _ranked_service_compare);
+
+  for (i = 0; i < ranked->len; i++)
+    {
+      RankedService *r = g_ptr_array_index (ranked, i);
+      AgAccount *account = ag_account_service_get_account (r->service);
+      gint64 start = startup_profile_begin (self->priv->profile);
 
-      if (account_name != NULL)
+      /* An account ranks as its best service */
+      if (!g_hash_table_contains (self->priv->ranks,
+              GUINT_TO_POINTER (account->id)))
+        {
+          guint rank = g_hash_table_size (self->priv->ranks) + 1;
+
+          g_hash_table_insert (self->priv->ranks,
+              GUINT_TO_POINTER (account->id), GUINT_TO_POINTER (rank));
+          startup_profile_set_rank (self->priv->profile, account->id, rank);
+        }
+
+      if (r->account_name != NULL)
         {
           /* This service was already known, we can add it now */
-          _add_service (self, service, account_name);
-          g_signal_connect (service, "enabled",
-              G_CALLBACK (_service_enabled_cb), self);
-          g_signal_connect (service, "changed",
-              G_CALLBACK (_service_changed_cb), self);
-          g_free (account_name);
+          _add_service (self, r->service, r->account_name);
+          _service_watch (self, r->service);
         }
       else
         {
@@ -588,42 +1958,219 @@ _ensure_loaded (McpAccountManagerAccountsSso *self)
           g_queue_push_tail (self->priv->pending_signals, data);
         }
 
-      g_object_unref (services->data);
-      services = g_list_delete_link (services, services);
+      startup_profile_end (self->priv->profile, STARTUP_PROFILE_ACCOUNT,
+          "load-account", account->id, start);
+    }
+
+  g_ptr_array_unref (ranked);
+
+  startup_profile_end (self->priv->profile, STARTUP_PROFILE_PHASE, "load",
+      0, load_start);
+}
+
+static GList *
+account_manager_accounts_sso_list (const McpAccountStorage *storage,
+    const McpAccountManager *am)
+{
+  McpAccountManagerAccountsSso *self = (McpAccountManagerAccountsSso *) storage;
+  GList *accounts = NULL;
+  GHashTableIter iter;
+  gpointer key;
+
+  DEBUG_IFACE ("%s", G_STRFUNC);
+
+  g_return_val_if_fail (self->priv->manager != NULL, NULL);
+
+  _ensure_loaded (self);
+
+  g_hash_table_iter_init (&iter, self->priv->accounts);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    accounts = g_list_prepend (accounts, g_strdup (key));
+
+  /* Let MC load the important accounts first */
+  return g_list_sort_with_data (accounts, _account_name_compare_rank, self);
+}
+
+/* Well known services are defined in Telepathy spec:
+ * http://telepathy.freedesktop.org/spec/Account.html#Property:Service */
+static const struct {
+  const gchar *provider;
+  const gchar *service;
+} default_provider_services[] = {
+  { "google", "google-talk" },
+};
+
+static void
+_load_provider_services (McpAccountManagerAccountsSso *self)
+{
+  GKeyFile *key_file = g_key_file_new ();
+  gchar **providers;
+  guint i;
+
+  self->priv->provider_services = g_hash_table_new_full (g_str_hash,
+      g_str_equal, g_free, g_free);
+
+  for (i = 0; i < G_N_ELEMENTS (default_provider_services); i++)
+    g_hash_table_insert (self->priv->provider_services,
+        g_strdup (default_provider_services[i].provider),
+        g_strdup (default_provider_services[i].service));
+
+  if (!g_key_file_load_from_dirs (key_file, PROVIDER_SERVICES_FILE,
+          (const gchar **) g_get_system_config_dirs (), NULL,
+          G_KEY_FILE_NONE, NULL))
+    {
+      g_key_file_free (key_file);
+      return;
+    }
+
+  providers = g_key_file_get_keys (key_file, PROVIDER_SERVICES_GROUP, NULL,
+      NULL);
+  for (i = 0; providers != NULL && providers[i] != NULL; i++)
+    {
+      gchar *service = g_key_file_get_string (key_file,
+          PROVIDER_SERVICES_GROUP, providers[i], NULL);
+
+      if (!tp_str_empty (service))
+        g_hash_table_replace (self->priv->provider_services,
+            g_strdup (providers[i]), service);
+      else
+        g_free (service);
+    }
+
+  DEBUG_LOAD ("Accounts SSO: %u provider to service mapping(s)",
+      g_hash_table_size (self->priv->provider_services));
+
+  g_strfreev (providers);
+  g_key_file_free (key_file);
+}
+
+static const gchar *
+_provider_to_tp_service_name (McpAccountManagerAccountsSso *self,
+    const gchar *provider_name)
+{
+  const gchar *service_name;
+
+  if (provider_name == NULL)
+    return NULL;
+
+  service_name = g_hash_table_lookup (self->priv->provider_services,
+      provider_name);
+
+  return service_name != NULL ? service_name : provider_name;
+}
+
+/* Getters of the keys that are not stored in settings; they return FALSE
+ * to fall back to the settings */
+typedef gboolean (*SpecialKeyGetter) (McpAccountManagerAccountsSso *self,
+    const McpAccountManager *am,
+    const gchar *account_name,
+    AgAccountService *service);
+
+static gboolean
+_get_enabled (McpAccountManagerAccountsSso *self,
+    const McpAccountManager *am,
+    const gchar *account_name,
+    AgAccountService *service)
+{
+  mcp_account_manager_set_value (am, account_name, "Enabled",
+      ag_account_service_get_enabled (service) ? "true" : "false");
+  return TRUE;
+}
+
+static gboolean
+_get_display_name (McpAccountManagerAccountsSso *self,
+    const McpAccountManager *am,
+    const gchar *account_name,
+    AgAccountService *service)
+{
+  AgAccount *account = ag_account_service_get_account (service);
+
+  mcp_account_manager_set_value (am, account_name, "DisplayName",
+      ag_account_get_display_name (account));
+  return TRUE;
+}
+
+static gboolean
+_get_service (McpAccountManagerAccountsSso *self,
+    const McpAccountManager *am,
+    const gchar *account_name,
+    AgAccountService *service)
+{
+  AgAccount *account = ag_account_service_get_account (service);
+
+  mcp_account_manager_set_value (am, account_name, "Service",
+      _provider_to_tp_service_name (self, ag_account_get_provider_name (account)));
+  return TRUE;
+}
+
+static gboolean
+_get_icon (McpAccountManagerAccountsSso *self,
+    const McpAccountManager *am,
+    const gchar *account_name,
+    AgAccountService *service)
+{
+  AgAccount *account = ag_account_service_get_account (service);
+  AgService *s = ag_account_service_get_service (service);
+  /* Try loading the icon from service, if that's empty, load the provider */
+  const gchar *icon_name = ag_service_get_icon_name (s);
+  AgProvider *provider;
+
+  if (!tp_str_empty (icon_name))
+    {
+      mcp_account_manager_set_value (am, account_name, "Icon", icon_name);
+      return TRUE;
     }
+
+  provider = ag_manager_get_provider (self->priv->manager,
+      ag_account_get_provider_name (account));
+  mcp_account_manager_set_value (am, account_name, "Icon",
+      provider != NULL ? ag_provider_get_icon_name (provider) : NULL);
+  if (provider != NULL)
+    ag_provider_unref (provider);
+
+  return TRUE;
 }
 
-static GList *
-account_manager_accounts_sso_list (const McpAccountStorage *storage,
-    const McpAccountManager *am)
+/* OAuth2 services get their cached access token as password, so the CM
+ * can connect without waiting on signond */
+static gboolean
+_get_password (McpAccountManagerAccountsSso *self,
+    const McpAccountManager *am,
+    const gchar *account_name,
+    AgAccountService *service)
 {
-  McpAccountManagerAccountsSso *self = (McpAccountManagerAccountsSso *) storage;
-  GList *accounts = NULL;
-  GHashTableIter iter;
-  gpointer key;
+  const gchar *token = _account_peek_token (self, account_name);
 
-  DEBUG (G_STRFUNC);
-
-  g_return_val_if_fail (self->priv->manager != NULL, NULL);
+  if (token == NULL)
+    return FALSE;
 
-  _ensure_loaded (self);
+  mcp_account_manager_set_value (am, account_name, KEY_PASSWORD, token);
+  return TRUE;
+}
 
-  g_hash_table_iter_init (&iter, self->priv->accounts);
-  while (g_hash_table_iter_next (&iter, &key, NULL))
-    accounts = g_list_prepend (accounts, g_strdup (key));
+static const struct {
+  const gchar *key;
+  SpecialKeyGetter get;
+} special_keys[] = {
+  { "Enabled", _get_enabled },
+  { "DisplayName", _get_display_name },
+  { "Service", _get_service },
+  { "Icon", _get_icon },
+  { KEY_PASSWORD, _get_password },
+};
 
-  return accounts;
-}
+/* static key -> SpecialKeyGetter, built once in class_init */
+static GHashTable *special_key_getters = NULL;
 
-static const gchar *
-provider_to_tp_service_name (const gchar *provider_name)
+static void
+_special_keys_init (void)
 {
-  /* Well known services are defined in Telepathy spec:
-   * http://telepathy.freedesktop.org/spec/Account.html#Property:Service */
-  if (!tp_strdiff (provider_name, "google"))
-    return "google-talk";
+  guint i;
 
-  return provider_name;
+  special_key_getters = g_hash_table_new (g_str_hash, g_str_equal);
+  for (i = 0; i < G_N_ELEMENTS (special_keys); i++)
+    g_hash_table_insert (special_key_getters, (gpointer) special_keys[i].key,
+        special_keys[i].get);
 }
 
 static gboolean
@@ -633,21 +2180,42 @@ account_manager_accounts_sso_get (const McpAccountStorage *storage,
     const gchar *key)
 {
   McpAccountManagerAccountsSso *self = (McpAccountManagerAccountsSso *) storage;
+  AccountEntry *entry;
   AgAccountService *service;
-  AgAccount *account;
-  AgService *s;
-  gboolean handled = FALSE;
+  SpecialKeyGetter getter;
+  const gchar *cached;
+  gchar *value;
+  gint64 start;
+  guint i;
 
   g_return_val_if_fail (self->priv->manager != NULL, FALSE);
 
-  service = g_hash_table_lookup (self->priv->accounts, account_name);
-  if (service == NULL)
+  entry = g_hash_table_lookup (self->priv->accounts, account_name);
+  if (entry == NULL)
     return FALSE;
 
-  DEBUG ("%s: %s, %s", G_STRFUNC, account_name, key);
+  VERBOSE_IFACE ("%s: %s, %s", G_STRFUNC, account_name, key);
 
-  account = ag_account_service_get_account (service);
-  s = ag_account_service_get_service (service);
+  if (key != NULL)
+    usage_store_count_key (self->priv->usage, key);
+
+  getter = (key != NULL) ? g_hash_table_lookup (special_key_getters, key) :
+      NULL;
+
+  /* Settings read before don't need the service, once the schema they are
+   * checked against is known */
+  if (key != NULL && getter == NULL && entry->schema_loaded &&
+      account_cache_lookup (self->priv->cache, account_name, key, &cached))
+    {
+      _set_setting (am, entry, key, cached);
+      return TRUE;
+    }
+
+  service = _account_entry_get_service (self, entry);
+  if (service == NULL)
+    return FALSE;
+
+  _account_entry_get_schema (self, entry, service);
 
   /* NULL key means we want all settings */
   if (key == NULL)
@@ -659,65 +2227,64 @@ account_manager_accounts_sso_get (const McpAccountStorage *storage,
       ag_account_service_settings_iter_init (service, &iter, KEY_PREFIX);
       while (ag_account_settings_iter_get_next (&iter, &k, &v))
         {
-          gchar *value = _tp_transform_to_string (v);
-          if (value)
-            {
-              mcp_account_manager_set_value (am, account_name, k, value);
-              g_free (value);
-            }
-        }
-    }
+          gchar *filtered;
 
-  /* Some special keys that are not stored in setting */
-  if (key == NULL || !tp_strdiff (key, "Enabled"))
-    {
-      mcp_account_manager_set_value (am, account_name, "Enabled",
-          ag_account_service_get_enabled (service) ? "true" : "false");
-      handled = TRUE;
-    }
+          value = _tp_transform_to_string (v);
+          if (value == NULL)
+            continue;
 
-  if (key == NULL || !tp_strdiff (key, "DisplayName"))
-    {
-      mcp_account_manager_set_value (am, account_name, "DisplayName",
-          ag_account_get_display_name (account));
-      handled = TRUE;
-    }
+          account_cache_insert (self->priv->cache, account_name, k, value, 0);
 
-  if (key == NULL || !tp_strdiff (key, "Service"))
-    {
-      mcp_account_manager_set_value (am, account_name, "Service",
-          provider_to_tp_service_name (ag_account_get_provider_name (account)));
-      handled = TRUE;
-    }
+          filtered = _filter_setting (entry, k, value);
+          if (filtered != NULL)
+            mcp_account_manager_set_value (am, account_name, k, filtered);
 
-  if (key == NULL || !tp_strdiff (key, "Icon"))
-    {
-      /* Try loading the icon from service, if that's empty, load the provider */
-      const gchar *icon_name = ag_service_get_icon_name (s);
-      if (strlen(icon_name) == 0)
-        {
-          AgProvider *provider = ag_manager_get_provider (self->priv->manager,
-                                                          ag_account_get_provider_name (account));
-          icon_name = ag_provider_get_icon_name (provider);
-          ag_provider_unref(provider);
+          g_free (filtered);
+          g_free (value);
         }
-      mcp_account_manager_set_value (am, account_name, "Icon",
-          icon_name);
-      handled = TRUE;
+
+      for (i = 0; i < G_N_ELEMENTS (special_keys); i++)
+        special_keys[i].get (self, am, account_name, service);
+
+      return TRUE;
     }
 
+  if (getter != NULL && getter (self, am, account_name, service))
+    return TRUE;
+
   /* If it was none of the above, then just lookup in service' settings */
-  if (!handled)
+  if (account_cache_lookup (self->priv->cache, account_name, key, &cached))
     {
-      gchar *value = _service_dup_tp_value (service, key);
-
-      mcp_account_manager_set_value (am, account_name, key, value);
-      g_free (value);
+      _set_setting (am, entry, key, cached);
+      return TRUE;
     }
 
+  start = g_get_monotonic_time ();
+  value = _service_dup_tp_value (service, key);
+  account_cache_insert (self->priv->cache, account_name, key, value,
+      g_get_monotonic_time () - start);
+  _set_setting (am, entry, key, value);
+  g_free (value);
+
   return TRUE;
 }
 
+/* Whether MC writing val to key means the account is being used */
+static gboolean
+_is_use (const gchar *key,
+    const gchar *val)
+{
+  if (!tp_strdiff (key, "Enabled"))
+    return !tp_strdiff (val, "true");
+
+  /* "<type>;<status>;<message>", written when a presence is requested */
+  if (!tp_strdiff (key, "RequestedPresence") && val != NULL)
+    return g_ascii_strtoull (val, NULL, 10) >
+        TP_CONNECTION_PRESENCE_TYPE_OFFLINE;
+
+  return FALSE;
+}
+
 static gboolean
 account_manager_accounts_sso_set (const McpAccountStorage *storage,
     const McpAccountManager *am,
@@ -726,18 +2293,31 @@ account_manager_accounts_sso_set (const McpAccountStorage *storage,
     const gchar *val)
 {
   McpAccountManagerAccountsSso *self = (McpAccountManagerAccountsSso *) storage;
+  AccountEntry *entry;
   AgAccountService *service;
   AgAccount *account;
 
   g_return_val_if_fail (self->priv->manager != NULL, FALSE);
 
-  service = g_hash_table_lookup (self->priv->accounts, account_name);
+  entry = g_hash_table_lookup (self->priv->accounts, account_name);
+  if (entry == NULL)
+    return FALSE;
+
+  service = _account_entry_get_service (self, entry);
   if (service == NULL)
     return FALSE;
 
   account = ag_account_service_get_account (service);
 
-  DEBUG ("%s: %s, %s, %s", G_STRFUNC, account_name, key, val);
+  VERBOSE_IFACE ("%s: %s, %s, %s", G_STRFUNC, account_name, key, val);
+
+  /* Kept until commit() stores it */
+  entry->dirty = TRUE;
+
+  /* MC writes to accounts for its own housekeeping too, e.g. at startup;
+   * only the user enabling the account or asking to go online is use */
+  if (_is_use (key, val))
+    usage_store_touch (self->priv->usage, account_name);
 
   if (!tp_strdiff (key, "Enabled"))
     {
@@ -750,9 +2330,14 @@ account_manager_accounts_sso_set (const McpAccountStorage *storage,
     {
       ag_account_set_display_name (account, val);
     }
+  else if (!tp_strdiff (key, KEY_PASSWORD) && entry->token_cred_id != 0)
+    {
+      /* That's the access token we handed out, don't persist it */
+    }
   else
     {
       _service_set_tp_value (service, key, val);
+      account_cache_insert (self->priv->cache, account_name, key, val, 0);
     }
 
   return TRUE;
@@ -786,49 +2371,252 @@ account_manager_accounts_sso_commit (const McpAccountStorage *storage,
   McpAccountManagerAccountsSso *self = (McpAccountManagerAccountsSso *) storage;
   GHashTableIter iter;
   gpointer value;
+  GHashTable *stored;
 
-  DEBUG (G_STRFUNC);
+  DEBUG_IFACE ("%s", G_STRFUNC);
 
   g_return_val_if_fail (self->priv->manager != NULL, FALSE);
 
+  /* Services of the same account share its store */
+  stored = g_hash_table_new (g_direct_hash, g_direct_equal);
+
   g_hash_table_iter_init (&iter, self->priv->accounts);
   while (g_hash_table_iter_next (&iter, NULL, &value))
     {
-      AgAccountService *service = value;
-      AgAccount *account = ag_account_service_get_account (service);
+      AccountEntry *entry = value;
+      AgAccount *account;
+
+      /* Services that were dropped had no changes */
+      if (entry->service == NULL)
+        continue;
+
+      entry->dirty = FALSE;
+      account = ag_account_service_get_account (entry->service);
+
+      if (g_hash_table_contains (stored, account))
+        continue;
 
-      ag_account_store_async (account, NULL, _account_stored_cb, self);
+      g_hash_table_add (stored, account);
+      store_tracker_store (self->priv->stores, account);
     }
 
+  g_hash_table_unref (stored);
+
+  usage_store_save (self->priv->usage);
+
+  /* Make sure MC's changes made it to the DB before it moves on */
+  store_tracker_flush (self->priv->stores, COMMIT_FLUSH_TIMEOUT_MS);
+
   return TRUE;
 }
 
+/* Caches the values of the hot keys of the account, from a single pass
+ * over its settings */
+static void
+_prefetch_account (McpAccountManagerAccountsSso *self,
+    AccountEntry *entry,
+    GHashTable *hot)
+{
+  gboolean was_loaded = (entry->service != NULL);
+  AgAccountService *service = _account_entry_get_service (self, entry);
+  AgAccountSettingIter iter;
+  GHashTable *missing;
+  GHashTableIter hot_iter;
+  gpointer key;
+  const gchar *k;
+  GVariant *v;
+
+  if (service == NULL)
+    return;
+
+  missing = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_iter_init (&hot_iter, hot);
+  while (g_hash_table_iter_next (&hot_iter, &key, NULL))
+    g_hash_table_add (missing, key);
+
+  ag_account_service_settings_iter_init (service, &iter, KEY_PREFIX);
+  while (ag_account_settings_iter_get_next (&iter, &k, &v))
+    {
+      gchar *value;
+
+      if (!g_hash_table_remove (missing, k))
+        continue;
+
+      value = _tp_transform_to_string (v);
+      account_cache_insert (self->priv->cache, entry->account_name, k, value,
+          0);
+      g_free (value);
+    }
+
+  /* The others are known to be unset */
+  g_hash_table_iter_init (&hot_iter, missing);
+  while (g_hash_table_iter_next (&hot_iter, &key, NULL))
+    account_cache_insert (self->priv->cache, entry->account_name, key, NULL,
+        0);
+
+  g_hash_table_unref (missing);
+
+  /* Only the values were wanted */
+  if (self->priv->lazy && !was_loaded && !entry->dirty)
+    {
+      tp_clear_object (&entry->service);
+      account_cache_set_extra (self->priv->cache, entry->account_name, 0);
+    }
+}
+
+/* Prefetch of the hot keys in progress, one account per idle callback so
+ * that MC isn't held up, nor all services loaded at once in lazy mode */
+typedef struct
+{
+    McpAccountManagerAccountsSso *self;
+    gchar **keys;
+    /* borrowed from keys */
+    GHashTable *hot;
+    /* alloc'ed names of the accounts left, in no particular order */
+    GPtrArray *pending;
+    guint n_accounts;
+    gint64 time;
+} PrefetchData;
+
+static void
+_prefetch_data_free (gpointer data)
+{
+  PrefetchData *prefetch = data;
+
+  g_ptr_array_unref (prefetch->pending);
+  g_hash_table_unref (prefetch->hot);
+  g_strfreev (prefetch->keys);
+  g_slice_free (PrefetchData, prefetch);
+}
+
+static gboolean
+_prefetch_hot_keys_cb (gpointer user_data)
+{
+  PrefetchData *prefetch = user_data;
+  McpAccountManagerAccountsSso *self = prefetch->self;
+  AccountEntry *entry = NULL;
+  gint64 start = g_get_monotonic_time ();
+
+  /* Accounts may have gone away meanwhile */
+  while (entry == NULL && prefetch->pending->len > 0)
+    {
+      guint last = prefetch->pending->len - 1;
+
+      entry = g_hash_table_lookup (self->priv->accounts,
+          g_ptr_array_index (prefetch->pending, last));
+      g_ptr_array_remove_index (prefetch->pending, last);
+    }
+
+  if (entry != NULL)
+    {
+      _prefetch_account (self, entry, prefetch->hot);
+      prefetch->n_accounts++;
+      prefetch->time += g_get_monotonic_time () - start;
+    }
+
+  if (prefetch->pending->len > 0)
+    return G_SOURCE_CONTINUE;
+
+  DEBUG_LOAD ("Accounts SSO: prefetched %u key(s) of %u account(s) in %"
+      G_GINT64_FORMAT "us", g_hash_table_size (prefetch->hot),
+      prefetch->n_accounts, prefetch->time);
+
+  self->priv->prefetch_id = 0;
+  return G_SOURCE_REMOVE;
+}
+
+static void
+_prefetch_hot_keys_start (McpAccountManagerAccountsSso *self)
+{
+  PrefetchData *prefetch;
+  GHashTableIter iter;
+  gpointer key;
+  guint i;
+
+  prefetch = g_slice_new0 (PrefetchData);
+  prefetch->self = self;
+  prefetch->keys = usage_store_dup_hot_keys (self->priv->usage,
+      PREFETCH_MAX_KEYS, PREFETCH_MIN_ACCESSES);
+
+  /* Only settings are cached */
+  prefetch->hot = g_hash_table_new (g_str_hash, g_str_equal);
+  for (i = 0; prefetch->keys[i] != NULL; i++)
+    {
+      if (!g_hash_table_contains (special_key_getters, prefetch->keys[i]))
+        g_hash_table_add (prefetch->hot, prefetch->keys[i]);
+    }
+
+  prefetch->pending = g_ptr_array_new_with_free_func (g_free);
+  if (g_hash_table_size (prefetch->hot) > 0)
+    {
+      g_hash_table_iter_init (&iter, self->priv->accounts);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        g_ptr_array_add (prefetch->pending, g_strdup (key));
+    }
+
+  if (prefetch->pending->len == 0)
+    {
+      _prefetch_data_free (prefetch);
+      return;
+    }
+
+  self->priv->prefetch_id = g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+      _prefetch_hot_keys_cb, prefetch, _prefetch_data_free);
+}
+
 static void
 account_manager_accounts_sso_ready (const McpAccountStorage *storage,
     const McpAccountManager *am)
 {
   McpAccountManagerAccountsSso *self = (McpAccountManagerAccountsSso *) storage;
   DelayedSignalData *data;
+  GHashTable *replayed;
+  GHashTableIter iter;
+  gpointer value;
+  gint64 ready_start;
 
   g_return_if_fail (self->priv->manager != NULL);
 
   if (self->priv->ready)
     return;
 
-  DEBUG (G_STRFUNC);
+  DEBUG_IFACE ("%s", G_STRFUNC);
+
+  ready_start = startup_profile_begin (self->priv->profile);
+
+  /* Accounts created while MC was not running are imported in one go:
+   * those whose name is already known are announced together, in rank
+   * order, at the end of the replay; those waiting on signon are
+   * announced on their own as soon as the reply comes. */
+  self->priv->import_batch = g_ptr_array_new_with_free_func (g_free);
+
+  /* AgAccountIds of the accounts already created by this replay; there
+   * is one delayed creation per service of the account */
+  replayed = g_hash_table_new (g_direct_hash, g_direct_equal);
 
   self->priv->ready = TRUE;
   self->priv->am = g_object_ref (G_OBJECT (am));
 
   while ((data = g_queue_pop_head (self->priv->pending_signals)) != NULL)
     {
+      gint64 start = startup_profile_begin (self->priv->profile);
+
       switch (data->signal)
         {
           case DELAYED_CREATE:
+            if (g_hash_table_contains (replayed,
+                    GUINT_TO_POINTER (data->account_id)))
+              break;
+
+            g_hash_table_add (replayed, GUINT_TO_POINTER (data->account_id));
             _account_created_cb (self->priv->manager, data->account_id, self);
+            startup_profile_end (self->priv->profile, STARTUP_PROFILE_ACCOUNT,
+                "replay-created", data->account_id, start);
             break;
           case DELAYED_DELETE:
             _account_deleted_cb (self->priv->manager, data->account_id, self);
+            startup_profile_end (self->priv->profile, STARTUP_PROFILE_ACCOUNT,
+                "replay-deleted", data->account_id, start);
             break;
           default:
             g_assert_not_reached ();
@@ -839,7 +2627,32 @@ account_manager_accounts_sso_ready (const McpAccountStorage *storage,
 
   g_queue_free (self->priv->pending_signals);
   self->priv->pending_signals = NULL;
+  g_hash_table_unref (replayed);
+
+  g_hash_table_iter_init (&iter, self->priv->accounts);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      AccountEntry *entry = value;
+
+      if (!entry->token_unseen)
+        continue;
+
+      entry->token_unseen = FALSE;
+      g_signal_emit_by_name (self, "altered-one", entry->account_name,
+          KEY_PASSWORD);
+    }
+
+  _import_batch_flush (self);
+
+  /* Unless MC already asked for them, tokens were left for now */
+  oauth2_token_cache_start (self->priv->tokens);
+
+  _prefetch_hot_keys_start (self);
 
+  startup_profile_end (self->priv->profile, STARTUP_PROFILE_PHASE, "ready",
+      0, ready_start);
+  startup_profile_mark_ready (self->priv->profile);
+  _startup_profile_check (self);
 }
 
 static void
@@ -848,19 +2661,16 @@ account_manager_accounts_sso_get_identifier (const McpAccountStorage *storage,
     GValue *identifier)
 {
   McpAccountManagerAccountsSso *self = (McpAccountManagerAccountsSso *) storage;
-  AgAccountService *service;
-  AgAccount *account;
+  AccountEntry *entry;
 
   g_return_if_fail (self->priv->manager != NULL);
 
-  service = g_hash_table_lookup (self->priv->accounts, account_name);
-  if (service == NULL)
+  entry = g_hash_table_lookup (self->priv->accounts, account_name);
+  if (entry == NULL)
     return;
 
-  account = ag_account_service_get_account (service);
-
   g_value_init (identifier, G_TYPE_UINT);
-  g_value_set_uint (identifier, account->id);
+  g_value_set_uint (identifier, entry->account_id);
 }
 
 static GHashTable *
@@ -874,7 +2684,7 @@ account_manager_accounts_sso_get_additional_info (const McpAccountStorage *stora
   GHashTable *ret = NULL;
 
   /* If we don't know this account, we cannot do anything */
-  service = g_hash_table_lookup (self->priv->accounts, account_name);
+  service = _lookup_service (self, account_name);
   if (service == NULL)
     return ret;
 
@@ -902,20 +2712,169 @@ account_manager_accounts_sso_get_restrictions (const McpAccountStorage *storage,
   g_return_val_if_fail (self->priv->manager != NULL, 0);
 
   /* If we don't know this account, we cannot do anything */
-  service = g_hash_table_lookup (self->priv->accounts, account_name);
+  service = _lookup_service (self, account_name);
   if (service == NULL)
     return G_MAXUINT;
 
+  /* The value is owned by the service */
   value = ag_account_service_get_variant (service,
       KEY_PREFIX KEY_READONLY_PARAMS, NULL);
 
-  if (value != NULL && g_variant_get_boolean (value))
+  if (value != NULL && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN) &&
+      g_variant_get_boolean (value))
     restrictions |= TP_STORAGE_RESTRICTION_FLAG_CANNOT_SET_PARAMETERS;
 
   /* FIXME: We can't set Icon either, but there is no flag for that */
   return restrictions;
 }
 
+/* Storage calls go through these, recording them when tracing is enabled */
+
+#define TRACE_BEGIN(storage) \
+  event_trace_begin (((McpAccountManagerAccountsSso *) (storage))->priv->trace)
+#define TRACE_RECORD(storage, event, start, name, detail) \
+  event_trace_record (((McpAccountManagerAccountsSso *) (storage))->priv->trace, \
+      event, start, 0, name, detail)
+
+static gboolean
+traced_get (const McpAccountStorage *storage,
+    const McpAccountManager *am,
+    const gchar *account_name,
+    const gchar *key)
+{
+  gint64 start = TRACE_BEGIN (storage);
+  gboolean ret = account_manager_accounts_sso_get (storage, am, account_name,
+      key);
+
+  TRACE_RECORD (storage, EVENT_TRACE_IFACE_GET, start, account_name, key);
+  return ret;
+}
+
+static GList *
+traced_list (const McpAccountStorage *storage,
+    const McpAccountManager *am)
+{
+  gint64 start = TRACE_BEGIN (storage);
+  GList *ret = account_manager_accounts_sso_list (storage, am);
+
+  TRACE_RECORD (storage, EVENT_TRACE_IFACE_LIST, start, NULL, NULL);
+  return ret;
+}
+
+static gboolean
+traced_set (const McpAccountStorage *storage,
+    const McpAccountManager *am,
+    const gchar *account_name,
+    const gchar *key,
+    const gchar *val)
+{
+  gint64 start = TRACE_BEGIN (storage);
+  gboolean ret = account_manager_accounts_sso_set (storage, am, account_name,
+      key, val);
+
+  TRACE_RECORD (storage, EVENT_TRACE_IFACE_SET, start, account_name, key);
+  return ret;
+}
+
+static gchar *
+traced_create (const McpAccountStorage *storage,
+    const McpAccountManager *am,
+    const gchar *cm_name,
+    const gchar *protocol_name,
+    GHashTable *params,
+    GError **error)
+{
+  gint64 start = TRACE_BEGIN (storage);
+  gchar *ret = account_manager_accounts_sso_create (storage, am, cm_name,
+      protocol_name, params, error);
+
+  TRACE_RECORD (storage, EVENT_TRACE_IFACE_CREATE, start, ret, protocol_name);
+  return ret;
+}
+
+static gboolean
+traced_delete (const McpAccountStorage *storage,
+    const McpAccountManager *am,
+    const gchar *account_name,
+    const gchar *key)
+{
+  gint64 start = TRACE_BEGIN (storage);
+  gboolean ret = account_manager_accounts_sso_delete (storage, am,
+      account_name, key);
+
+  TRACE_RECORD (storage, EVENT_TRACE_IFACE_DELETE, start, account_name, key);
+  return ret;
+}
+
+static gboolean
+traced_commit (const McpAccountStorage *storage,
+    const McpAccountManager *am)
+{
+  McpAccountManagerAccountsSso *self = (McpAccountManagerAccountsSso *) storage;
+  gint64 start = TRACE_BEGIN (storage);
+  gboolean ret = account_manager_accounts_sso_commit (storage, am);
+
+  TRACE_RECORD (storage, EVENT_TRACE_IFACE_COMMIT, start, NULL, NULL);
+  event_trace_flush (self->priv->trace);
+  return ret;
+}
+
+static void
+traced_ready (const McpAccountStorage *storage,
+    const McpAccountManager *am)
+{
+  McpAccountManagerAccountsSso *self = (McpAccountManagerAccountsSso *) storage;
+  gint64 start = TRACE_BEGIN (storage);
+
+  account_manager_accounts_sso_ready (storage, am);
+
+  TRACE_RECORD (storage, EVENT_TRACE_IFACE_READY, start, NULL, NULL);
+  event_trace_flush (self->priv->trace);
+}
+
+static void
+traced_get_identifier (const McpAccountStorage *storage,
+    const gchar *account_name,
+    GValue *identifier)
+{
+  gint64 start = TRACE_BEGIN (storage);
+
+  account_manager_accounts_sso_get_identifier (storage, account_name,
+      identifier);
+
+  TRACE_RECORD (storage, EVENT_TRACE_IFACE_GET_IDENTIFIER, start,
+      account_name, NULL);
+}
+
+static guint
+traced_get_restrictions (const McpAccountStorage *storage,
+    const gchar *account_name)
+{
+  gint64 start = TRACE_BEGIN (storage);
+  guint ret = account_manager_accounts_sso_get_restrictions (storage,
+      account_name);
+
+  TRACE_RECORD (storage, EVENT_TRACE_IFACE_GET_RESTRICTIONS, start,
+      account_name, NULL);
+  return ret;
+}
+
+static GHashTable *
+traced_get_additional_info (const McpAccountStorage *storage,
+    const gchar *account_name)
+{
+  gint64 start = TRACE_BEGIN (storage);
+  GHashTable *ret = account_manager_accounts_sso_get_additional_info (storage,
+      account_name);
+
+  TRACE_RECORD (storage, EVENT_TRACE_IFACE_GET_ADDITIONAL_INFO, start,
+      account_name, NULL);
+  return ret;
+}
+
+#undef TRACE_BEGIN
+#undef TRACE_RECORD
+
 static void
 account_storage_iface_init (McpAccountStorageIface *iface)
 {
@@ -924,7 +2883,7 @@ account_storage_iface_init (McpAccountStorageIface *iface)
   iface->priority = PLUGIN_PRIORITY;
   iface->provider = PLUGIN_PROVIDER;
 
-#define IMPLEMENT(x) iface->x = account_manager_accounts_sso_##x
+#define IMPLEMENT(x) iface->x = traced_##x
   IMPLEMENT (get);
   IMPLEMENT (list);
   IMPLEMENT (set);
@@ -6,9 +6,33 @@ CONFIG -= qt
 PKGCONFIG += mission-control-plugins libaccounts-glib libsignon-glib
 
 SOURCES = mcp-account-manager-accounts-sso.c \
+        oauth2-token-cache.c \
+        event-trace.c \
+        startup-profile.c \
+        usage-store.c \
+        sso-counters.c \
+        store-tracker.c \
+        account-cache.c \
+        account-name.c \
+        protocol-schema.c \
+        sso-log.c \
         mission-control-plugin.c
 
-HEADERS = mcp-account-manager-accounts-sso.h
+HEADERS = mcp-account-manager-accounts-sso.h \
+        oauth2-token-cache.h \
+        event-trace.h \
+        startup-profile.h \
+        usage-store.h \
+        sso-counters.h \
+        store-tracker.h \
+        account-cache.h \
+        account-name.h \
+        protocol-schema.h \
+        sso-log.h
 
 target.path = $$system(pkg-config --variable=plugindir mission-control-plugins)
-INSTALLS += target
+
+services.files = services.conf
+services.path = /etc/xdg/telepathy-accounts-signon
+
+INSTALLS += target services
@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "oauth2-token-cache.h"
+#include "sso-log.h"
+
+#include <gio/gio.h>
+
+#include <libsignon-glib/signon-identity.h>
+#include <libsignon-glib/signon-auth-session.h>
+#include <libsignon-glib/signon-errors.h>
+
+#define DEBUG(...) \
+  SSO_LOG (SSO_LOG_SIGNON, SSO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#define OAUTH2_METHOD "oauth2"
+
+/* Refresh this long before the token expires; tokens with a shorter
+ * lifetime are refreshed half way through it instead. */
+#define REFRESH_MARGIN_SECONDS 300
+/* Delay before trying again after a failed request; requests that need
+ * user interaction are not retried on a timer, see
+ * oauth2_token_cache_retry() */
+#define RETRY_SECONDS 60
+
+struct _OAuth2TokenCache
+{
+  /* credentials id -> owned TokenEntry */
+  GHashTable *entries;
+
+  OAuth2TokenChangedFunc changed;
+  gpointer user_data;
+
+  /* Tokens are requested as soon as watched */
+  gboolean started;
+};
+
+typedef struct
+{
+  OAuth2TokenCache *cache;
+  guint credentials_id;
+  guint watchers;
+
+  gchar *method;
+  gchar *mechanism;
+  GVariant *parameters;
+
+  SignonIdentity *identity;
+  SignonAuthSession *session;
+  /* Non-NULL while a request is in flight */
+  GCancellable *cancellable;
+
+  gchar *access_token;
+  /* Monotonic time in microseconds, 0 if the token does not expire */
+  gint64 expires_at;
+  guint refresh_id;
+  /* Signond can't give a token without asking the user */
+  gboolean needs_ui;
+} TokenEntry;
+
+static void _token_entry_request (TokenEntry *entry, gboolean force);
+
+static void
+_token_entry_free (gpointer data)
+{
+  TokenEntry *entry = data;
+
+  if (entry->refresh_id != 0)
+    g_source_remove (entry->refresh_id);
+
+  /* The reply callback owns its own reference to the cancellable and
+   * drops the reply once it has been cancelled */
+  if (entry->cancellable != NULL)
+    {
+      g_object_set_data (G_OBJECT (entry->cancellable), "entry", NULL);
+      g_cancellable_cancel (entry->cancellable);
+      g_object_unref (entry->cancellable);
+    }
+
+  g_clear_object (&entry->session);
+  g_clear_object (&entry->identity);
+  g_clear_pointer (&entry->parameters, g_variant_unref);
+  g_free (entry->method);
+  g_free (entry->mechanism);
+  g_free (entry->access_token);
+  g_slice_free (TokenEntry, entry);
+}
+
+static gboolean
+_token_entry_refresh_cb (gpointer user_data)
+{
+  TokenEntry *entry = user_data;
+
+  entry->refresh_id = 0;
+  _token_entry_request (entry, TRUE);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+_token_entry_schedule (TokenEntry *entry,
+    guint seconds)
+{
+  if (entry->refresh_id != 0)
+    g_source_remove (entry->refresh_id);
+
+  entry->refresh_id = g_timeout_add_seconds (seconds,
+      _token_entry_refresh_cb, entry);
+}
+
+static gint64
+_reply_get_expires_in (GVariant *reply)
+{
+  GVariant *value = g_variant_lookup_value (reply, "ExpiresIn", NULL);
+  gint64 ret = 0;
+
+  if (value == NULL)
+    return 0;
+
+  if (g_variant_is_of_type (value, G_VARIANT_TYPE_INT32))
+    ret = g_variant_get_int32 (value);
+  else if (g_variant_is_of_type (value, G_VARIANT_TYPE_UINT32))
+    ret = g_variant_get_uint32 (value);
+  else if (g_variant_is_of_type (value, G_VARIANT_TYPE_INT64))
+    ret = g_variant_get_int64 (value);
+
+  g_variant_unref (value);
+  return MAX (ret, 0);
+}
+
+static void
+_token_reply_cb (GObject *source_object,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  GCancellable *cancellable = user_data;
+  TokenEntry *entry;
+  GVariant *reply;
+  GError *error = NULL;
+  gchar *token = NULL;
+  gint64 expires_in;
+
+  reply = signon_auth_session_process_finish (
+      SIGNON_AUTH_SESSION (source_object), res, &error);
+
+  if (g_cancellable_is_cancelled (cancellable))
+    {
+      /* The entry is already gone */
+      g_clear_error (&error);
+      if (reply != NULL)
+        g_variant_unref (reply);
+      g_object_unref (cancellable);
+      return;
+    }
+
+  entry = g_object_get_data (G_OBJECT (cancellable), "entry");
+  g_assert (entry != NULL && entry->cancellable == cancellable);
+  g_clear_object (&entry->cancellable);
+  g_object_unref (cancellable);
+
+  if (reply == NULL)
+    {
+      DEBUG ("Accounts SSO: OAuth2 token request for credentials %u failed: %s",
+          entry->credentials_id, error->message);
+
+      /* Polling would not help until the user logs in again */
+      if (g_error_matches (error, SIGNON_ERROR, SIGNON_ERROR_USER_INTERACTION))
+        entry->needs_ui = TRUE;
+      else
+        _token_entry_schedule (entry, RETRY_SECONDS);
+
+      g_error_free (error);
+      return;
+    }
+
+  if (!g_variant_lookup (reply, "AccessToken", "s", &token) ||
+      token[0] == '\0')
+    {
+      DEBUG ("Accounts SSO: OAuth2 reply for credentials %u has no token",
+          entry->credentials_id);
+      g_free (token);
+      g_variant_unref (reply);
+      _token_entry_schedule (entry, RETRY_SECONDS);
+      return;
+    }
+
+  expires_in = _reply_get_expires_in (reply);
+  g_variant_unref (reply);
+
+  g_free (entry->access_token);
+  entry->access_token = token;
+  entry->needs_ui = FALSE;
+
+  if (expires_in > 0)
+    {
+      gint64 margin = MIN (REFRESH_MARGIN_SECONDS, expires_in / 2);
+
+      entry->expires_at = g_get_monotonic_time () + expires_in * G_USEC_PER_SEC;
+      _token_entry_schedule (entry, MAX (expires_in - margin, 1));
+    }
+  else
+    {
+      entry->expires_at = 0;
+    }
+
+  DEBUG ("Accounts SSO: got OAuth2 token for credentials %u, expires in %"
+      G_GINT64_FORMAT "s", entry->credentials_id, expires_in);
+
+  if (entry->cache->changed != NULL)
+    entry->cache->changed (entry->credentials_id, entry->cache->user_data);
+}
+
+static void
+_token_entry_request (TokenEntry *entry,
+    gboolean force)
+{
+  GVariantBuilder builder;
+  GVariantIter iter;
+  const gchar *key;
+  GVariant *value;
+  GError *error = NULL;
+
+  if (entry->cancellable != NULL)
+    return;
+
+  if (entry->session == NULL)
+    {
+      entry->session = signon_identity_create_session (entry->identity,
+          entry->method, &error);
+      if (entry->session == NULL)
+        {
+          DEBUG ("Accounts SSO: cannot create auth session for credentials %u: %s",
+              entry->credentials_id, error->message);
+          g_error_free (error);
+          _token_entry_schedule (entry, RETRY_SECONDS);
+          return;
+        }
+    }
+
+  /* Never let a background request pop up signon-ui; on refresh, ask the
+   * OAuth2 plugin to skip its own cache since the token is about to
+   * expire anyway. */
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_iter_init (&iter, entry->parameters);
+  while (g_variant_iter_next (&iter, "{&sv}", &key, &value))
+    {
+      if (g_strcmp0 (key, SIGNON_SESSION_DATA_UI_POLICY) != 0)
+        g_variant_builder_add (&builder, "{sv}", key, value);
+      g_variant_unref (value);
+    }
+  g_variant_builder_add (&builder, "{sv}", SIGNON_SESSION_DATA_UI_POLICY,
+      g_variant_new_int32 (SIGNON_POLICY_NO_USER_INTERACTION));
+  if (force)
+    g_variant_builder_add (&builder, "{sv}", "ForceTokenRefresh",
+        g_variant_new_boolean (TRUE));
+
+  entry->cancellable = g_cancellable_new ();
+  g_object_set_data (G_OBJECT (entry->cancellable), "entry", entry);
+
+  signon_auth_session_process_async (entry->session,
+      g_variant_builder_end (&builder), entry->mechanism,
+      entry->cancellable, _token_reply_cb, g_object_ref (entry->cancellable));
+}
+
+OAuth2TokenCache *
+oauth2_token_cache_new (OAuth2TokenChangedFunc changed,
+    gpointer user_data)
+{
+  OAuth2TokenCache *cache = g_slice_new0 (OAuth2TokenCache);
+
+  cache->changed = changed;
+  cache->user_data = user_data;
+
+  cache->entries = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      NULL, _token_entry_free);
+
+  return cache;
+}
+
+void
+oauth2_token_cache_free (OAuth2TokenCache *cache)
+{
+  if (cache == NULL)
+    return;
+
+  g_hash_table_unref (cache->entries);
+  g_slice_free (OAuth2TokenCache, cache);
+}
+
+gboolean
+oauth2_auth_data_is_oauth2 (AgAuthData *auth_data)
+{
+  return auth_data != NULL &&
+      g_strcmp0 (ag_auth_data_get_method (auth_data), OAUTH2_METHOD) == 0 &&
+      ag_auth_data_get_credentials_id (auth_data) != 0;
+}
+
+void
+oauth2_token_cache_watch (OAuth2TokenCache *cache,
+    AgAuthData *auth_data)
+{
+  guint cred_id;
+  TokenEntry *entry;
+
+  g_return_if_fail (oauth2_auth_data_is_oauth2 (auth_data));
+
+  cred_id = ag_auth_data_get_credentials_id (auth_data);
+  entry = g_hash_table_lookup (cache->entries, GUINT_TO_POINTER (cred_id));
+  if (entry != NULL)
+    {
+      entry->watchers++;
+      return;
+    }
+
+  entry = g_slice_new0 (TokenEntry);
+  entry->cache = cache;
+  entry->credentials_id = cred_id;
+  entry->watchers = 1;
+  entry->method = g_strdup (ag_auth_data_get_method (auth_data));
+  entry->mechanism = g_strdup (ag_auth_data_get_mechanism (auth_data));
+  entry->parameters = g_variant_ref_sink (
+      ag_auth_data_get_login_parameters (auth_data, NULL));
+  entry->identity = signon_identity_new_from_db (cred_id);
+
+  g_hash_table_insert (cache->entries, GUINT_TO_POINTER (cred_id), entry);
+
+  if (entry->identity == NULL)
+    {
+      DEBUG ("Accounts SSO: cannot create signon identity (cred_id %u) for OAuth2",
+          cred_id);
+      return;
+    }
+
+  if (cache->started)
+    _token_entry_request (entry, FALSE);
+}
+
+void
+oauth2_token_cache_unwatch (OAuth2TokenCache *cache,
+    guint credentials_id)
+{
+  TokenEntry *entry = g_hash_table_lookup (cache->entries,
+      GUINT_TO_POINTER (credentials_id));
+
+  if (entry == NULL)
+    return;
+
+  if (--entry->watchers == 0)
+    g_hash_table_remove (cache->entries, GUINT_TO_POINTER (credentials_id));
+}
+
+void
+oauth2_token_cache_start (OAuth2TokenCache *cache)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  if (cache->started)
+    return;
+
+  cache->started = TRUE;
+
+  g_hash_table_iter_init (&iter, cache->entries);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      TokenEntry *entry = value;
+
+      /* Some may have been peeked already */
+      if (entry->identity != NULL && entry->access_token == NULL &&
+          !entry->needs_ui)
+        _token_entry_request (entry, FALSE);
+    }
+}
+
+void
+oauth2_token_cache_retry (OAuth2TokenCache *cache,
+    guint credentials_id)
+{
+  TokenEntry *entry = g_hash_table_lookup (cache->entries,
+      GUINT_TO_POINTER (credentials_id));
+
+  if (entry == NULL || !entry->needs_ui || entry->identity == NULL)
+    return;
+
+  entry->needs_ui = FALSE;
+  _token_entry_request (entry, FALSE);
+}
+
+const gchar *
+oauth2_token_cache_peek (OAuth2TokenCache *cache,
+    guint credentials_id)
+{
+  TokenEntry *entry = g_hash_table_lookup (cache->entries,
+      GUINT_TO_POINTER (credentials_id));
+
+  if (entry == NULL || entry->identity == NULL)
+    return NULL;
+
+  if (entry->access_token == NULL)
+    {
+      /* Not started yet, or the first request is still in flight or
+       * failed and will be retried */
+      if (!entry->needs_ui && entry->refresh_id == 0)
+        _token_entry_request (entry, FALSE);
+      return NULL;
+    }
+
+  if (entry->expires_at != 0 && g_get_monotonic_time () >= entry->expires_at)
+    {
+      /* The background refresh did not make it in time */
+      if (!entry->needs_ui)
+        _token_entry_request (entry, TRUE);
+      return NULL;
+    }
+
+  return entry->access_token;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __OAUTH2_TOKEN_CACHE_H__
+#define __OAUTH2_TOKEN_CACHE_H__
+
+#include <glib.h>
+
+#include <libaccounts-glib/ag-auth-data.h>
+
+G_BEGIN_DECLS
+
+/* In-memory cache of OAuth2 access tokens, keyed by signon credentials id.
+ * Tokens are requested from signond without user interaction and refreshed
+ * in the background shortly before they expire, so that a valid token is
+ * normally available without any round-trip when a CM connects. */
+typedef struct _OAuth2TokenCache OAuth2TokenCache;
+
+/* Called whenever a new token arrives for the credentials id, whether the
+ * first one or a refresh */
+typedef void (*OAuth2TokenChangedFunc) (guint credentials_id,
+    gpointer user_data);
+
+OAuth2TokenCache *oauth2_token_cache_new (OAuth2TokenChangedFunc changed,
+    gpointer user_data);
+void oauth2_token_cache_free (OAuth2TokenCache *cache);
+
+gboolean oauth2_auth_data_is_oauth2 (AgAuthData *auth_data);
+
+/* Each watch must be balanced by an unwatch of the same credentials id.
+ * Tokens are only requested once the cache is started, or when peeked. */
+void oauth2_token_cache_watch (OAuth2TokenCache *cache,
+    AgAuthData *auth_data);
+void oauth2_token_cache_unwatch (OAuth2TokenCache *cache,
+    guint credentials_id);
+
+/* Requests tokens for the credentials watched so far, and from now on as
+ * soon as they are watched; meant to keep signond off the startup path */
+void oauth2_token_cache_start (OAuth2TokenCache *cache);
+
+/* Requests a token again for credentials that needed user interaction,
+ * e.g. after the account changed; does nothing otherwise */
+void oauth2_token_cache_retry (OAuth2TokenCache *cache,
+    guint credentials_id);
+
+/* Returns the cached token if it has not expired, or NULL after requesting
+ * one if needed */
+const gchar *oauth2_token_cache_peek (OAuth2TokenCache *cache,
+    guint credentials_id);
+
+G_END_DECLS
+
+#endif
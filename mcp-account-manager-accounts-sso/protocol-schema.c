@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "protocol-schema.h"
+#include "sso-log.h"
+
+#include <string.h>
+
+#define DEBUG(...) \
+  SSO_LOG (SSO_LOG_LOAD, SSO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#define MANAGERS_DIR "telepathy/managers"
+#define PROTOCOL_GROUP_PREFIX "Protocol "
+#define PARAM_PREFIX "param-"
+
+typedef enum {
+  PARAM_TYPE_OTHER,
+  PARAM_TYPE_STRING,
+  PARAM_TYPE_BOOLEAN,
+  PARAM_TYPE_SIGNED,
+  PARAM_TYPE_UNSIGNED,
+  PARAM_TYPE_DOUBLE,
+} ParamType;
+
+struct _ProtocolSchema
+{
+  /* alloc'ed "param-<name>" -> ParamType */
+  GHashTable *params;
+};
+
+struct _ProtocolSchemaCache
+{
+  /* alloc'ed "<cm>/<protocol>" -> owned ProtocolSchema, NULL if there is
+   * none */
+  GHashTable *schemas;
+};
+
+static void
+_protocol_schema_free (gpointer data)
+{
+  ProtocolSchema *schema = data;
+
+  if (schema == NULL)
+    return;
+
+  g_hash_table_unref (schema->params);
+  g_slice_free (ProtocolSchema, schema);
+}
+
+/* Maps the D-Bus signature starting a .manager parameter declaration */
+static ParamType
+_param_type_from_signature (const gchar *declaration)
+{
+  gchar *signature = g_strndup (declaration, strcspn (declaration, " \t"));
+  ParamType type = PARAM_TYPE_OTHER;
+
+  if (strcmp (signature, "s") == 0 || strcmp (signature, "o") == 0)
+    type = PARAM_TYPE_STRING;
+  else if (strcmp (signature, "b") == 0)
+    type = PARAM_TYPE_BOOLEAN;
+  else if (strcmp (signature, "n") == 0 || strcmp (signature, "i") == 0 ||
+      strcmp (signature, "x") == 0)
+    type = PARAM_TYPE_SIGNED;
+  else if (strcmp (signature, "y") == 0 || strcmp (signature, "q") == 0 ||
+      strcmp (signature, "u") == 0 || strcmp (signature, "t") == 0)
+    type = PARAM_TYPE_UNSIGNED;
+  else if (strcmp (signature, "d") == 0)
+    type = PARAM_TYPE_DOUBLE;
+
+  g_free (signature);
+  return type;
+}
+
+static ProtocolSchema *
+_protocol_schema_load (const gchar *cm_name,
+    const gchar *protocol_name)
+{
+  GKeyFile *key_file;
+  GPtrArray *dirs;
+  const gchar * const *system_dirs;
+  ProtocolSchema *schema = NULL;
+  gchar *file, *group;
+  gchar **keys;
+  guint i;
+
+  /* It ends up in a path */
+  if (strchr (cm_name, '/') != NULL || cm_name[0] == '.')
+    return NULL;
+
+  /* The user's data dir comes first, as for any XDG data */
+  dirs = g_ptr_array_new ();
+  g_ptr_array_add (dirs, (gpointer) g_get_user_data_dir ());
+  for (system_dirs = g_get_system_data_dirs (); *system_dirs != NULL;
+      system_dirs++)
+    g_ptr_array_add (dirs, (gpointer) *system_dirs);
+  g_ptr_array_add (dirs, NULL);
+
+  key_file = g_key_file_new ();
+  file = g_strdup_printf (MANAGERS_DIR "/%s.manager", cm_name);
+  group = g_strconcat (PROTOCOL_GROUP_PREFIX, protocol_name, NULL);
+
+  if (!g_key_file_load_from_dirs (key_file, file,
+          (const gchar **) dirs->pdata, NULL, G_KEY_FILE_NONE, NULL) ||
+      !g_key_file_has_group (key_file, group))
+    {
+      DEBUG ("Accounts SSO: no parameters declared for %s/%s, not "
+          "filtering them", cm_name, protocol_name);
+      goto out;
+    }
+
+  schema = g_slice_new0 (ProtocolSchema);
+  schema->params = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      NULL);
+
+  keys = g_key_file_get_keys (key_file, group, NULL, NULL);
+  for (i = 0; keys != NULL && keys[i] != NULL; i++)
+    {
+      gchar *declaration;
+
+      /* Defaults are "default-<name>" keys, not parameters */
+      if (!g_str_has_prefix (keys[i], PARAM_PREFIX))
+        continue;
+
+      declaration = g_key_file_get_value (key_file, group, keys[i], NULL);
+      if (declaration == NULL)
+        continue;
+
+      g_hash_table_insert (schema->params, g_strdup (keys[i]),
+          GUINT_TO_POINTER (_param_type_from_signature (declaration)));
+      g_free (declaration);
+    }
+  g_strfreev (keys);
+
+  DEBUG ("Accounts SSO: %s/%s declares %u parameter(s)", cm_name,
+      protocol_name, g_hash_table_size (schema->params));
+
+out:
+  g_free (group);
+  g_free (file);
+  g_key_file_free (key_file);
+  g_ptr_array_free (dirs, TRUE);
+  return schema;
+}
+
+ProtocolSchemaCache *
+protocol_schema_cache_new (void)
+{
+  ProtocolSchemaCache *cache = g_slice_new0 (ProtocolSchemaCache);
+
+  cache->schemas = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      _protocol_schema_free);
+
+  return cache;
+}
+
+void
+protocol_schema_cache_free (ProtocolSchemaCache *cache)
+{
+  if (cache == NULL)
+    return;
+
+  g_hash_table_unref (cache->schemas);
+  g_slice_free (ProtocolSchemaCache, cache);
+}
+
+const ProtocolSchema *
+protocol_schema_cache_lookup (ProtocolSchemaCache *cache,
+    const gchar *cm_name,
+    const gchar *protocol_name)
+{
+  ProtocolSchema *schema;
+  gpointer value;
+  gchar *key;
+
+  if (cm_name == NULL || cm_name[0] == '\0' ||
+      protocol_name == NULL || protocol_name[0] == '\0')
+    return NULL;
+
+  key = g_strdup_printf ("%s/%s", cm_name, protocol_name);
+
+  if (g_hash_table_lookup_extended (cache->schemas, key, NULL, &value))
+    {
+      g_free (key);
+      return value;
+    }
+
+  /* Missing ones are remembered too */
+  schema = _protocol_schema_load (cm_name, protocol_name);
+  g_hash_table_insert (cache->schemas, key, schema);
+
+  return schema;
+}
+
+gchar *
+protocol_schema_filter (const ProtocolSchema *schema,
+    const gchar *key,
+    const gchar *value)
+{
+  gpointer type;
+  gchar *end;
+
+  if (!g_str_has_prefix (key, PARAM_PREFIX))
+    return g_strdup (value);
+
+  if (!g_hash_table_lookup_extended (schema->params, key, NULL, &type))
+    return NULL;
+
+  switch (GPOINTER_TO_UINT (type))
+    {
+      case PARAM_TYPE_BOOLEAN:
+        if (strcmp (value, "true") == 0 || strcmp (value, "1") == 0)
+          return g_strdup ("true");
+        if (strcmp (value, "false") == 0 || strcmp (value, "0") == 0)
+          return g_strdup ("false");
+        return NULL;
+
+      case PARAM_TYPE_SIGNED:
+        g_ascii_strtoll (value, &end, 10);
+        break;
+
+      case PARAM_TYPE_UNSIGNED:
+        if (value[0] == '-')
+          return NULL;
+        g_ascii_strtoull (value, &end, 10);
+        break;
+
+      case PARAM_TYPE_DOUBLE:
+        g_ascii_strtod (value, &end);
+        break;
+
+      default:
+        return g_strdup (value);
+    }
+
+  /* Numbers must be nothing but */
+  if (end == value || *end != '\0')
+    return NULL;
+
+  return g_strdup (value);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __PROTOCOL_SCHEMA_H__
+#define __PROTOCOL_SCHEMA_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The parameters a connection manager declares for a protocol, as listed
+ * in its telepathy/managers/<cm>.manager file, and their types */
+typedef struct _ProtocolSchema ProtocolSchema;
+
+/* Schemas by connection manager and protocol, each file being read once */
+typedef struct _ProtocolSchemaCache ProtocolSchemaCache;
+
+ProtocolSchemaCache *protocol_schema_cache_new (void);
+void protocol_schema_cache_free (ProtocolSchemaCache *cache);
+
+/* Returns NULL if the connection manager has no .manager file, or it does
+ * not declare the protocol; the schema is owned by the cache */
+const ProtocolSchema *protocol_schema_cache_lookup (ProtocolSchemaCache *cache,
+    const gchar *cm_name,
+    const gchar *protocol_name);
+
+/* Returns the value to hand to MC for the setting key, converted to the
+ * form of its declared type, or NULL if the parameter is not declared or
+ * the value does not fit its type. Keys that are not parameters are kept
+ * as they are. */
+gchar *protocol_schema_filter (const ProtocolSchema *schema,
+    const gchar *key,
+    const gchar *value);
+
+G_END_DECLS
+
+#endif
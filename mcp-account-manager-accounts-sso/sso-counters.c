@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "sso-counters.h"
+#include "sso-log.h"
+
+#define DEBUG(...) \
+  SSO_LOG (SSO_LOG_LOAD, SSO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/* Everything runs in the main loop, no need for atomics */
+static guint64 counters[SSO_N_COUNTERS];
+
+static const gchar * const counter_names[SSO_N_COUNTERS] = {
+  "signon-queries",
+  "signon-retries",
+  "signon-timeouts",
+  "signon-failures",
+  "signon-negative-hits",
+  "stores",
+  "store-failures",
+  "services-materialized",
+  "services-evicted",
+  "wakeups-handled",
+  "wakeups-ignored",
+};
+
+void
+sso_counter_inc (SsoCounter counter)
+{
+  g_return_if_fail (counter < SSO_N_COUNTERS);
+
+  counters[counter]++;
+}
+
+void
+sso_counter_add (SsoCounter counter,
+    guint64 value)
+{
+  g_return_if_fail (counter < SSO_N_COUNTERS);
+
+  counters[counter] += value;
+}
+
+guint64
+sso_counter_get (SsoCounter counter)
+{
+  g_return_val_if_fail (counter < SSO_N_COUNTERS, 0);
+
+  return counters[counter];
+}
+
+const gchar *
+sso_counter_name (SsoCounter counter)
+{
+  g_return_val_if_fail (counter < SSO_N_COUNTERS, NULL);
+
+  return counter_names[counter];
+}
+
+void
+sso_counters_log (const gchar *when)
+{
+  GString *line = g_string_new (NULL);
+  guint i;
+
+  for (i = 0; i < SSO_N_COUNTERS; i++)
+    {
+      if (counters[i] != 0)
+        g_string_append_printf (line, " %s=%" G_GUINT64_FORMAT,
+            counter_names[i], counters[i]);
+    }
+
+  DEBUG ("Accounts SSO: counters at %s:%s", when,
+      line->len > 0 ? line->str : " none");
+
+  g_string_free (line, TRUE);
+}
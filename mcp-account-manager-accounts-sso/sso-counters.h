@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __SSO_COUNTERS_H__
+#define __SSO_COUNTERS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Process-wide event counters of the plugin, for diagnostics. Add new
+ * counters at the end, along with their name in sso-counters.c. */
+typedef enum {
+  SSO_COUNTER_SIGNON_QUERIES,
+  SSO_COUNTER_SIGNON_RETRIES,
+  SSO_COUNTER_SIGNON_TIMEOUTS,
+  SSO_COUNTER_SIGNON_FAILURES,
+  SSO_COUNTER_SIGNON_NEGATIVE_HITS,
+  SSO_COUNTER_STORES,
+  SSO_COUNTER_STORE_FAILURES,
+  SSO_COUNTER_SERVICES_MATERIALIZED,
+  SSO_COUNTER_SERVICES_EVICTED,
+  SSO_COUNTER_WAKEUPS_HANDLED,
+  SSO_COUNTER_WAKEUPS_IGNORED,
+
+  SSO_N_COUNTERS
+} SsoCounter;
+
+void sso_counter_inc (SsoCounter counter);
+void sso_counter_add (SsoCounter counter,
+    guint64 value);
+guint64 sso_counter_get (SsoCounter counter);
+const gchar *sso_counter_name (SsoCounter counter);
+
+/* Logs all non-zero counters on one line */
+void sso_counters_log (const gchar *when);
+
+G_END_DECLS
+
+#endif
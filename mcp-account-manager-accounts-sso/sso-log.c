@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "sso-log.h"
+
+#include <string.h>
+
+/* Each call site logs at most this many messages per window; the number
+ * of messages dropped is logged once the window is over */
+#define RATE_LIMIT_WINDOW_USEC G_USEC_PER_SEC
+#define RATE_LIMIT_BURST 20
+
+/* Until sso_log_init() */
+SsoLogLevel sso_log_levels[SSO_LOG_N_CATEGORIES] = {
+  SSO_LOG_LEVEL_NONE,
+  SSO_LOG_LEVEL_NONE,
+  SSO_LOG_LEVEL_NONE,
+  SSO_LOG_LEVEL_NONE,
+};
+
+static const gchar * const category_names[SSO_LOG_N_CATEGORIES] = {
+  "load",
+  "signon",
+  "storage-iface",
+  "signals",
+};
+
+static const gchar * const level_names[] = {
+  "none",
+  "info",
+  "debug",
+  "verbose",
+};
+
+typedef struct {
+  /* Of the first message of the call site */
+  const gchar *format;
+  gint64 window_start;
+  guint count;
+  guint suppressed;
+} RateLimit;
+
+/* Call site location -> owned RateLimit; everything runs in the main loop.
+ * Identical formats are often merged by the compiler, so they can't tell
+ * call sites apart. */
+static GHashTable *rate_limits = NULL;
+/* Reports the messages suppressed at call sites that went quiet since */
+static guint report_id = 0;
+
+static gboolean
+_parse_level (const gchar *name,
+    SsoLogLevel *level)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (level_names); i++)
+    {
+      if (strcmp (name, level_names[i]) == 0)
+        {
+          *level = i;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/* Whether g_log()'s default handler shows our debug messages */
+static gboolean
+_messages_debug_enabled (void)
+{
+  const gchar *domains = g_getenv ("G_MESSAGES_DEBUG");
+  const gchar *domain = G_LOG_DOMAIN;
+
+  if (domains == NULL || domains[0] == '\0')
+    return FALSE;
+
+  /* gmessages.h makes G_LOG_DOMAIN NULL unless the build defines it, and
+   * messages without a domain are shown whatever the list */
+  if (domain == NULL)
+    return TRUE;
+
+  return strcmp (domains, "all") == 0 || strstr (domains, domain) != NULL;
+}
+
+void
+sso_log_init (void)
+{
+  const gchar *env = g_getenv (SSO_LOG_ENV);
+  SsoLogLevel level = _messages_debug_enabled () ?
+      SSO_LOG_LEVEL_DEBUG : SSO_LOG_LEVEL_NONE;
+  gchar **specs;
+  guint i, j;
+
+  /* Don't format messages only for g_log() to drop them */
+  for (j = 0; j < SSO_LOG_N_CATEGORIES; j++)
+    sso_log_levels[j] = level;
+
+  if (env == NULL)
+    return;
+
+  specs = g_strsplit (env, ",", -1);
+  for (i = 0; specs[i] != NULL; i++)
+    {
+      gchar **spec = g_strsplit (g_strstrip (specs[i]), "=", 2);
+      SsoLogLevel level;
+
+      if (spec[0] == NULL || spec[1] == NULL ||
+          !_parse_level (spec[1], &level))
+        {
+          g_strfreev (spec);
+          continue;
+        }
+
+      for (j = 0; j < SSO_LOG_N_CATEGORIES; j++)
+        {
+          if (strcmp (spec[0], "all") == 0 ||
+              strcmp (spec[0], category_names[j]) == 0)
+            sso_log_levels[j] = level;
+        }
+
+      g_strfreev (spec);
+    }
+  g_strfreev (specs);
+}
+
+static void
+_rate_limit_free (gpointer data)
+{
+  g_slice_free (RateLimit, data);
+}
+
+static void
+_rate_limit_report (const gchar *location,
+    RateLimit *limit)
+{
+  if (limit->suppressed > 0)
+    g_log (G_LOG_DOMAIN, G_LOG_LEVEL_DEBUG,
+        "Accounts SSO: %u message(s) like \"%s\" suppressed at %s",
+        limit->suppressed, limit->format, location);
+
+  limit->suppressed = 0;
+}
+
+static gboolean
+_report_cb (gpointer user_data)
+{
+  gint64 now = g_get_monotonic_time ();
+  gboolean pending = FALSE;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init (&iter, rate_limits);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      RateLimit *limit = value;
+
+      if (limit->suppressed == 0)
+        continue;
+
+      if (now - limit->window_start >= RATE_LIMIT_WINDOW_USEC)
+        {
+          _rate_limit_report (key, limit);
+          limit->window_start = now;
+          limit->count = 0;
+        }
+      else
+        {
+          pending = TRUE;
+        }
+    }
+
+  if (pending)
+    return G_SOURCE_CONTINUE;
+
+  report_id = 0;
+  return G_SOURCE_REMOVE;
+}
+
+/* Returns FALSE if the message must be dropped */
+static gboolean
+_rate_limit_check (const gchar *location,
+    const gchar *format)
+{
+  gint64 now = g_get_monotonic_time ();
+  RateLimit *limit;
+
+  if (rate_limits == NULL)
+    rate_limits = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+        _rate_limit_free);
+
+  limit = g_hash_table_lookup (rate_limits, location);
+  if (limit == NULL)
+    {
+      limit = g_slice_new0 (RateLimit);
+      limit->format = format;
+      limit->window_start = now;
+      g_hash_table_insert (rate_limits, (gpointer) location, limit);
+    }
+
+  if (now - limit->window_start >= RATE_LIMIT_WINDOW_USEC)
+    {
+      _rate_limit_report (location, limit);
+      limit->window_start = now;
+      limit->count = 0;
+    }
+
+  if (++limit->count > RATE_LIMIT_BURST)
+    {
+      limit->suppressed++;
+
+      /* The call site may not log again for a long time */
+      if (report_id == 0)
+        report_id = g_timeout_add (RATE_LIMIT_WINDOW_USEC / 1000,
+            _report_cb, NULL);
+
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+void
+sso_log_message (SsoLogCategory category,
+    SsoLogLevel level,
+    const gchar *location,
+    const gchar *format,
+    ...)
+{
+  va_list args;
+
+  if (!_rate_limit_check (location, format))
+    return;
+
+  va_start (args, format);
+  g_logv (G_LOG_DOMAIN,
+      level == SSO_LOG_LEVEL_INFO ? G_LOG_LEVEL_INFO : G_LOG_LEVEL_DEBUG,
+      format, args);
+  va_end (args);
+}
+
+void
+sso_log_flush (void)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+
+  if (report_id != 0)
+    {
+      g_source_remove (report_id);
+      report_id = 0;
+    }
+
+  if (rate_limits == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, rate_limits);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    _rate_limit_report (key, value);
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __SSO_LOG_H__
+#define __SSO_LOG_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Set MC_ACCOUNTS_SSO_LOG to a comma-separated list of category=level,
+ * e.g. "all=info,signon=verbose", to change the levels logged at runtime.
+ * Nothing is logged by default, unless G_MESSAGES_DEBUG would let the
+ * messages through, in which case all categories are at debug level.
+ * Messages still go through g_log(), so G_MESSAGES_DEBUG applies too. */
+#define SSO_LOG_ENV "MC_ACCOUNTS_SSO_LOG"
+
+typedef enum {
+  SSO_LOG_LOAD,
+  SSO_LOG_SIGNON,
+  SSO_LOG_STORAGE_IFACE,
+  SSO_LOG_SIGNALS,
+
+  SSO_LOG_N_CATEGORIES
+} SsoLogCategory;
+
+typedef enum {
+  SSO_LOG_LEVEL_NONE = 0,
+  SSO_LOG_LEVEL_INFO = 1,
+  /* The default at runtime with G_MESSAGES_DEBUG */
+  SSO_LOG_LEVEL_DEBUG = 2,
+  /* Every storage call and the like */
+  SSO_LOG_LEVEL_VERBOSE = 3,
+} SsoLogLevel;
+
+/* Calls of a level above this are compiled out; see config.h */
+#ifndef SSO_LOG_MAX_LEVEL
+#define SSO_LOG_MAX_LEVEL SSO_LOG_LEVEL_DEBUG
+#endif
+
+/* Current level of each category, only to be read by SSO_LOG */
+extern SsoLogLevel sso_log_levels[SSO_LOG_N_CATEGORIES];
+
+/* Reads SSO_LOG_ENV */
+void sso_log_init (void);
+/* Logs the messages still being suppressed by the rate limit */
+void sso_log_flush (void);
+
+/* Arguments are only evaluated, and the message formatted, if it is to be
+ * logged; call sites logging in bursts are rate limited. */
+#define SSO_LOG(category, level, ...) \
+  G_STMT_START { \
+    if ((level) <= SSO_LOG_MAX_LEVEL && \
+        (level) <= sso_log_levels[(category)]) \
+      sso_log_message ((category), (level), G_STRLOC, __VA_ARGS__); \
+  } G_STMT_END
+
+/* location must be a string literal identifying the call site */
+void sso_log_message (SsoLogCategory category,
+    SsoLogLevel level,
+    const gchar *location,
+    const gchar *format,
+    ...) G_GNUC_PRINTF (4, 5);
+
+G_END_DECLS
+
+#endif
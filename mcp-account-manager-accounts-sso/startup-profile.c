@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "startup-profile.h"
+#include "sso-log.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#define DEBUG(...) \
+  SSO_LOG (SSO_LOG_LOAD, SSO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+struct _StartupProfile
+{
+  gint64 origin;
+  gint64 ready;
+  guint pending;
+
+  /* of Span */
+  GArray *spans;
+
+  /* account id -> startup rank */
+  GHashTable *ranks;
+};
+
+typedef struct {
+  const gchar *category;
+  /* Interned */
+  const gchar *name;
+  guint account_id;
+  gint64 start;
+  gint64 duration;
+} Span;
+
+StartupProfile *
+startup_profile_new (void)
+{
+  StartupProfile *profile = g_slice_new0 (StartupProfile);
+
+  profile->origin = g_get_monotonic_time ();
+  profile->spans = g_array_new (FALSE, FALSE, sizeof (Span));
+  profile->ranks = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  return profile;
+}
+
+void
+startup_profile_free (StartupProfile *profile)
+{
+  if (profile == NULL)
+    return;
+
+  g_array_unref (profile->spans);
+  g_hash_table_unref (profile->ranks);
+  g_slice_free (StartupProfile, profile);
+}
+
+gint64
+startup_profile_begin (StartupProfile *profile)
+{
+  if (profile == NULL)
+    return 0;
+
+  return g_get_monotonic_time ();
+}
+
+void
+startup_profile_end (StartupProfile *profile,
+    const gchar *category,
+    const gchar *name,
+    guint account_id,
+    gint64 start)
+{
+  Span span;
+
+  if (profile == NULL)
+    return;
+
+  span.category = category;
+  span.name = g_intern_string (name);
+  span.account_id = account_id;
+  span.start = start - profile->origin;
+  span.duration = g_get_monotonic_time () - start;
+
+  g_array_append_val (profile->spans, span);
+}
+
+void
+startup_profile_set_rank (StartupProfile *profile,
+    guint account_id,
+    guint rank)
+{
+  if (profile != NULL)
+    g_hash_table_insert (profile->ranks, GUINT_TO_POINTER (account_id),
+        GUINT_TO_POINTER (rank));
+}
+
+void
+startup_profile_mark_ready (StartupProfile *profile)
+{
+  if (profile != NULL && profile->ready == 0)
+    profile->ready = g_get_monotonic_time () - profile->origin;
+}
+
+void
+startup_profile_hold (StartupProfile *profile)
+{
+  if (profile != NULL)
+    profile->pending++;
+}
+
+void
+startup_profile_release (StartupProfile *profile)
+{
+  if (profile != NULL && profile->pending > 0)
+    profile->pending--;
+}
+
+gboolean
+startup_profile_is_complete (StartupProfile *profile)
+{
+  return profile != NULL && profile->ready != 0 && profile->pending == 0;
+}
+
+static void
+_write_json (StartupProfile *profile,
+    const gchar *path)
+{
+  GString *json = g_string_new ("{\"traceEvents\":[");
+  GError *error = NULL;
+  guint i;
+
+  for (i = 0; i < profile->spans->len; i++)
+    {
+      Span *span = &g_array_index (profile->spans, Span, i);
+      gchar *name = g_strescape (span->name, NULL);
+      guint rank = GPOINTER_TO_UINT (g_hash_table_lookup (profile->ranks,
+          GUINT_TO_POINTER (span->account_id)));
+
+      g_string_append_printf (json,
+          "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+          "\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT ","
+          "\"pid\":%d,\"tid\":1,\"args\":{\"account\":%u,\"rank\":%u}}",
+          i > 0 ? "," : "", name, span->category, span->start,
+          span->duration, (int) getpid (), span->account_id, rank);
+      g_free (name);
+    }
+
+  g_string_append_printf (json,
+      "%s\n{\"name\":\"ready\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"p\","
+      "\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":1}\n]}\n",
+      profile->spans->len > 0 ? "," : "", STARTUP_PROFILE_PHASE,
+      profile->ready, (int) getpid ());
+
+  if (!g_file_set_contents (path, json->str, json->len, &error))
+    {
+      DEBUG ("Accounts SSO: cannot write startup profile: %s",
+          error->message);
+      g_error_free (error);
+    }
+
+  g_string_free (json, TRUE);
+}
+
+void
+startup_profile_report (StartupProfile *profile)
+{
+  GString *summary = g_string_new (NULL);
+  const gchar *path;
+  guint accounts = 0, queries = 0;
+  gint64 account_time = 0, signon_time = 0, signon_end = 0;
+  /* When the work on the first ranked account was last done */
+  gint64 first_ranked_end = 0;
+  guint i;
+
+  if (profile == NULL)
+    return;
+
+  for (i = 0; i < profile->spans->len; i++)
+    {
+      Span *span = &g_array_index (profile->spans, Span, i);
+
+      if (!strcmp (span->category, STARTUP_PROFILE_PHASE))
+        {
+          g_string_append_printf (summary, " %s %.1fms,", span->name,
+              span->duration / 1000.0);
+        }
+      else if (!strcmp (span->category, STARTUP_PROFILE_ACCOUNT))
+        {
+          accounts++;
+          account_time += span->duration;
+        }
+      else if (!strcmp (span->category, STARTUP_PROFILE_SIGNON))
+        {
+          queries++;
+          signon_time += span->duration;
+          signon_end = MAX (signon_end, span->start + span->duration);
+        }
+
+      if (span->account_id != 0 &&
+          GPOINTER_TO_UINT (g_hash_table_lookup (profile->ranks,
+              GUINT_TO_POINTER (span->account_id))) == 1)
+        first_ranked_end = MAX (first_ranked_end,
+            span->start + span->duration);
+    }
+
+  DEBUG ("Accounts SSO: startup:%s %u account steps %.1fms, "
+      "%u signon queries %.1fms (done at %.1fms), %u ranked accounts "
+      "(first done at %.1fms), ready at %.1fms",
+      summary->str, accounts, account_time / 1000.0,
+      queries, signon_time / 1000.0, signon_end / 1000.0,
+      g_hash_table_size (profile->ranks), first_ranked_end / 1000.0,
+      profile->ready / 1000.0);
+
+  g_string_free (summary, TRUE);
+
+  path = g_getenv (STARTUP_PROFILE_ENV);
+  if (path != NULL && path[0] != '\0')
+    _write_json (profile, path);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __STARTUP_PROFILE_H__
+#define __STARTUP_PROFILE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Path of the Chrome trace (JSON) export; the summary is always logged */
+#define STARTUP_PROFILE_ENV "MC_ACCOUNTS_SSO_PROFILE"
+
+/* Span categories */
+#define STARTUP_PROFILE_PHASE "phase"
+#define STARTUP_PROFILE_ACCOUNT "account"
+#define STARTUP_PROFILE_SIGNON "signon"
+
+/* Monotonic timing of the plugin's startup, from instance init until
+ * ready() and the signon queries it started have completed. */
+typedef struct _StartupProfile StartupProfile;
+
+StartupProfile *startup_profile_new (void);
+void startup_profile_free (StartupProfile *profile);
+
+/* Returns the time to pass to startup_profile_end(), 0 if profile is NULL */
+gint64 startup_profile_begin (StartupProfile *profile);
+void startup_profile_end (StartupProfile *profile,
+    const gchar *category,
+    const gchar *name,
+    guint account_id,
+    gint64 start);
+
+/* Records the position of the account in the startup order, 1 first */
+void startup_profile_set_rank (StartupProfile *profile,
+    guint account_id,
+    guint rank);
+
+/* Marks the end of ready(); async work may still be pending */
+void startup_profile_mark_ready (StartupProfile *profile);
+
+/* Keeps the profile open until async work (e.g. a signon query) is done */
+void startup_profile_hold (StartupProfile *profile);
+void startup_profile_release (StartupProfile *profile);
+gboolean startup_profile_is_complete (StartupProfile *profile);
+
+/* Logs a summary and writes the JSON export if requested */
+void startup_profile_report (StartupProfile *profile);
+
+G_END_DECLS
+
+#endif
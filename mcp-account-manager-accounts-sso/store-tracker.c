@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "store-tracker.h"
+#include "sso-log.h"
+#include "sso-counters.h"
+
+#define DEBUG(...) \
+  SSO_LOG (SSO_LOG_STORAGE_IFACE, SSO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/* How often the default main context runs the tracker's one while stores
+ * are in flight */
+#define DISPATCH_INTERVAL_MS 20
+
+struct _StoreTracker
+{
+  guint ref_count;
+
+  /* Where the stores complete */
+  GMainContext *context;
+  /* Runs context from the default one, 0 when no store is in flight */
+  guint dispatch_id;
+
+  guint in_flight;
+  guint completed;
+  guint failed;
+  gint64 total_latency;
+  gint64 max_latency;
+};
+
+typedef struct
+{
+  StoreTracker *tracker;
+  gint64 start;
+} StoreOp;
+
+StoreTracker *
+store_tracker_new (void)
+{
+  StoreTracker *tracker = g_slice_new0 (StoreTracker);
+
+  tracker->ref_count = 1;
+  tracker->context = g_main_context_new ();
+  return tracker;
+}
+
+StoreTracker *
+store_tracker_ref (StoreTracker *tracker)
+{
+  tracker->ref_count++;
+  return tracker;
+}
+
+void
+store_tracker_unref (StoreTracker *tracker)
+{
+  if (tracker == NULL || --tracker->ref_count > 0)
+    return;
+
+  g_main_context_unref (tracker->context);
+  g_slice_free (StoreTracker, tracker);
+}
+
+static void
+_account_stored_cb (GObject *source_object,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  AgAccount *account = AG_ACCOUNT(source_object);
+  StoreOp *op = user_data;
+  StoreTracker *tracker = op->tracker;
+  gint64 latency = g_get_monotonic_time () - op->start;
+  GError *error = NULL;
+
+  tracker->in_flight--;
+  tracker->completed++;
+  tracker->total_latency += latency;
+  tracker->max_latency = MAX (tracker->max_latency, latency);
+
+  if (!ag_account_store_finish (account, res, &error))
+    {
+      g_assert (error != NULL);
+      DEBUG ("Error storing Accounts SSO account '%s': %s",
+          ag_account_get_display_name (account),
+          error->message);
+      g_error_free(error);
+
+      tracker->failed++;
+      sso_counter_inc (SSO_COUNTER_STORE_FAILURES);
+    }
+
+  store_tracker_unref (tracker);
+  g_slice_free (StoreOp, op);
+}
+
+static gboolean
+_dispatch_cb (gpointer user_data)
+{
+  StoreTracker *tracker = user_data;
+
+  while (g_main_context_iteration (tracker->context, FALSE))
+    ;
+
+  if (tracker->in_flight > 0)
+    return G_SOURCE_CONTINUE;
+
+  tracker->dispatch_id = 0;
+  return G_SOURCE_REMOVE;
+}
+
+void
+store_tracker_store (StoreTracker *tracker,
+    AgAccount *account)
+{
+  StoreOp *op = g_slice_new0 (StoreOp);
+
+  op->tracker = store_tracker_ref (tracker);
+  op->start = g_get_monotonic_time ();
+
+  tracker->in_flight++;
+  sso_counter_inc (SSO_COUNTER_STORES);
+
+  /* The completion is dispatched in the thread-default context */
+  g_main_context_push_thread_default (tracker->context);
+  ag_account_store_async (account, NULL, _account_stored_cb, op);
+  g_main_context_pop_thread_default (tracker->context);
+
+  if (tracker->dispatch_id == 0)
+    tracker->dispatch_id = g_timeout_add_full (G_PRIORITY_DEFAULT,
+        DISPATCH_INTERVAL_MS, _dispatch_cb, store_tracker_ref (tracker),
+        (GDestroyNotify) store_tracker_unref);
+}
+
+static gboolean
+_flush_timeout_cb (gpointer user_data)
+{
+  gboolean *timed_out = user_data;
+
+  *timed_out = TRUE;
+  return G_SOURCE_REMOVE;
+}
+
+gboolean
+store_tracker_flush (StoreTracker *tracker,
+    guint timeout_ms)
+{
+  gboolean timed_out = FALSE;
+  GSource *source;
+
+  if (tracker->in_flight == 0)
+    return TRUE;
+
+  DEBUG ("Accounts SSO: waiting for %u account store(s)", tracker->in_flight);
+
+  source = g_timeout_source_new (timeout_ms);
+  g_source_set_callback (source, _flush_timeout_cb, &timed_out, NULL);
+  g_source_attach (source, tracker->context);
+
+  while (tracker->in_flight > 0 && !timed_out)
+    g_main_context_iteration (tracker->context, TRUE);
+
+  g_source_destroy (source);
+  g_source_unref (source);
+
+  if (tracker->in_flight > 0)
+    DEBUG ("Accounts SSO: %u account store(s) still in flight after %ums",
+        tracker->in_flight, timeout_ms);
+
+  return tracker->in_flight == 0;
+}
+
+void
+store_tracker_log_stats (StoreTracker *tracker)
+{
+  DEBUG ("Accounts SSO: account stores: %u done, %u in flight, "
+      "%u failed (%.1f%%), latency avg %.1fms max %.1fms",
+      tracker->completed, tracker->in_flight, tracker->failed,
+      tracker->completed > 0 ? 100.0 * tracker->failed / tracker->completed : 0.0,
+      tracker->completed > 0 ? tracker->total_latency / 1000.0 / tracker->completed : 0.0,
+      tracker->max_latency / 1000.0);
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __STORE_TRACKER_H__
+#define __STORE_TRACKER_H__
+
+#include <glib.h>
+
+#include <libaccounts-glib/ag-account.h>
+
+G_BEGIN_DECLS
+
+/* Keeps track of the ag_account_store_async() calls in flight, their
+ * latency and failures, and allows waiting for them to complete.
+ *
+ * The stores complete in a main context of the tracker's own, so waiting
+ * for them doesn't dispatch anything else; it is run from the default main
+ * context while stores are in flight. */
+typedef struct _StoreTracker StoreTracker;
+
+StoreTracker *store_tracker_new (void);
+/* Pending stores keep their own reference */
+StoreTracker *store_tracker_ref (StoreTracker *tracker);
+void store_tracker_unref (StoreTracker *tracker);
+
+void store_tracker_store (StoreTracker *tracker,
+    AgAccount *account);
+
+/* Waits until no store is in flight, or for at most timeout_ms, only
+ * running the tracker's context. Returns TRUE if all stores completed. */
+gboolean store_tracker_flush (StoreTracker *tracker,
+    guint timeout_ms);
+
+/* Logs the number of stores, their failure rate and latency */
+void store_tracker_log_stats (StoreTracker *tracker);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "usage-store.h"
+#include "sso-log.h"
+
+#include <glib/gstdio.h>
+
+#include <string.h>
+
+#define DEBUG(...) \
+  SSO_LOG (SSO_LOG_LOAD, SSO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#define USAGE_DIR "telepathy-accounts-signon"
+#define USAGE_FILE "usage"
+
+#define GROUP_LAST_USED "LastUsed"
+#define GROUP_KEY_ACCESS "KeyAccess"
+
+/* Don't rewrite the file for uses closer than this to the recorded one */
+#define LAST_USED_RESOLUTION_SECONDS 60
+
+/* Key access counts are halved once one of them reaches this, so that the
+ * histogram follows changes in what is asked for */
+#define KEY_ACCESS_MAX_COUNT (1 << 16)
+
+/* Changes to the histogram alone are only written this long after the last
+ * save, or by usage_store_flush() */
+#define KEY_ACCESS_SAVE_INTERVAL_SECONDS (30 * 60)
+
+struct _UsageStore
+{
+  gchar *path;
+  GKeyFile *key_file;
+  /* alloc'ed key -> alloc'ed guint, accesses since the last merge */
+  GHashTable *key_accesses;
+  /* Last used times changed since the last save */
+  gboolean dirty;
+  /* Histogram changed since the last save */
+  gboolean keys_dirty;
+  /* Monotonic time of the last save, or of the load */
+  gint64 saved_time;
+};
+
+UsageStore *
+usage_store_load (void)
+{
+  UsageStore *store = g_slice_new0 (UsageStore);
+
+  store->path = g_build_filename (g_get_user_data_dir (), USAGE_DIR,
+      USAGE_FILE, NULL);
+  store->key_file = g_key_file_new ();
+  store->key_accesses = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, g_free);
+  store->saved_time = g_get_monotonic_time ();
+
+  /* A missing or broken file is just an empty store */
+  g_key_file_load_from_file (store->key_file, store->path, G_KEY_FILE_NONE,
+      NULL);
+
+  return store;
+}
+
+/* Adds the counted accesses to the histogram in the key file */
+static void
+_merge_key_accesses (UsageStore *store)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  gchar **keys;
+  gboolean halve = FALSE;
+  guint i;
+
+  if (g_hash_table_size (store->key_accesses) == 0)
+    return;
+
+  g_hash_table_iter_init (&iter, store->key_accesses);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      guint64 count = g_key_file_get_uint64 (store->key_file,
+          GROUP_KEY_ACCESS, key, NULL) + *(guint *) value;
+
+      g_key_file_set_uint64 (store->key_file, GROUP_KEY_ACCESS, key, count);
+      halve |= (count >= KEY_ACCESS_MAX_COUNT);
+    }
+
+  g_hash_table_remove_all (store->key_accesses);
+  store->keys_dirty = TRUE;
+
+  if (!halve)
+    return;
+
+  keys = g_key_file_get_keys (store->key_file, GROUP_KEY_ACCESS, NULL, NULL);
+  for (i = 0; keys != NULL && keys[i] != NULL; i++)
+    {
+      guint64 count = g_key_file_get_uint64 (store->key_file,
+          GROUP_KEY_ACCESS, keys[i], NULL) / 2;
+
+      if (count > 0)
+        g_key_file_set_uint64 (store->key_file, GROUP_KEY_ACCESS, keys[i],
+            count);
+      else
+        g_key_file_remove_key (store->key_file, GROUP_KEY_ACCESS, keys[i],
+            NULL);
+    }
+  g_strfreev (keys);
+}
+
+static void
+_save (UsageStore *store)
+{
+  GError *error = NULL;
+  gchar *dir, *data;
+  gsize len;
+
+  dir = g_path_get_dirname (store->path);
+  g_mkdir_with_parents (dir, 0700);
+  g_free (dir);
+
+  data = g_key_file_to_data (store->key_file, &len, NULL);
+  if (!g_file_set_contents (store->path, data, len, &error))
+    {
+      DEBUG ("Accounts SSO: cannot save usage data: %s", error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      store->dirty = FALSE;
+      store->keys_dirty = FALSE;
+    }
+
+  /* Don't retry a failed save at each commit either */
+  store->saved_time = g_get_monotonic_time ();
+
+  g_free (data);
+}
+
+void
+usage_store_save (UsageStore *store)
+{
+  if (store == NULL)
+    return;
+
+  _merge_key_accesses (store);
+
+  if (store->dirty ||
+      (store->keys_dirty && g_get_monotonic_time () - store->saved_time >=
+          KEY_ACCESS_SAVE_INTERVAL_SECONDS * G_USEC_PER_SEC))
+    _save (store);
+}
+
+void
+usage_store_flush (UsageStore *store)
+{
+  if (store == NULL)
+    return;
+
+  _merge_key_accesses (store);
+
+  if (store->dirty || store->keys_dirty)
+    _save (store);
+}
+
+void
+usage_store_free (UsageStore *store)
+{
+  if (store == NULL)
+    return;
+
+  g_hash_table_unref (store->key_accesses);
+  g_key_file_free (store->key_file);
+  g_free (store->path);
+  g_slice_free (UsageStore, store);
+}
+
+gint64
+usage_store_get_last_used (UsageStore *store,
+    const gchar *account_name)
+{
+  return g_key_file_get_int64 (store->key_file, GROUP_LAST_USED,
+      account_name, NULL);
+}
+
+void
+usage_store_touch (UsageStore *store,
+    const gchar *account_name)
+{
+  gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+
+  if (now - usage_store_get_last_used (store, account_name) <
+      LAST_USED_RESOLUTION_SECONDS)
+    return;
+
+  g_key_file_set_int64 (store->key_file, GROUP_LAST_USED, account_name, now);
+  store->dirty = TRUE;
+}
+
+void
+usage_store_forget (UsageStore *store,
+    const gchar *account_name)
+{
+  if (g_key_file_remove_key (store->key_file, GROUP_LAST_USED, account_name,
+          NULL))
+    store->dirty = TRUE;
+}
+
+void
+usage_store_count_key (UsageStore *store,
+    const gchar *key)
+{
+  guint *count = g_hash_table_lookup (store->key_accesses, key);
+
+  /* MC asks for the same few keys over and over */
+  if (count == NULL)
+    {
+      count = g_new0 (guint, 1);
+      g_hash_table_insert (store->key_accesses, g_strdup (key), count);
+    }
+
+  (*count)++;
+}
+
+typedef struct {
+  gchar *key;
+  guint64 count;
+} KeyCount;
+
+static gint
+_key_count_compare (gconstpointer a,
+    gconstpointer b)
+{
+  const KeyCount *ka = a;
+  const KeyCount *kb = b;
+
+  if (ka->count != kb->count)
+    return ka->count > kb->count ? -1 : 1;
+
+  return strcmp (ka->key, kb->key);
+}
+
+gchar **
+usage_store_dup_hot_keys (UsageStore *store,
+    guint max_keys,
+    guint64 min_count)
+{
+  GArray *counts = g_array_new (FALSE, FALSE, sizeof (KeyCount));
+  GPtrArray *ret = g_ptr_array_new ();
+  gchar **keys;
+  guint i;
+
+  _merge_key_accesses (store);
+
+  keys = g_key_file_get_keys (store->key_file, GROUP_KEY_ACCESS, NULL, NULL);
+  for (i = 0; keys != NULL && keys[i] != NULL; i++)
+    {
+      KeyCount kc;
+
+      kc.key = keys[i];
+      kc.count = g_key_file_get_uint64 (store->key_file, GROUP_KEY_ACCESS,
+          keys[i], NULL);
+
+      if (kc.count >= min_count)
+        g_array_append_val (counts, kc);
+    }
+
+  g_array_sort (counts, _key_count_compare);
+
+  for (i = 0; i < counts->len && i < max_keys; i++)
+    g_ptr_array_add (ret, g_strdup (g_array_index (counts, KeyCount, i).key));
+  g_ptr_array_add (ret, NULL);
+
+  g_array_free (counts, TRUE);
+  g_strfreev (keys);
+
+  return (gchar **) g_ptr_array_free (ret, FALSE);
+}
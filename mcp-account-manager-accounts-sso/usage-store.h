@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __USAGE_STORE_H__
+#define __USAGE_STORE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Usage data the plugin keeps across runs, in the user data dir; it is
+ * only a hint for ordering work, so losing it is harmless. */
+typedef struct _UsageStore UsageStore;
+
+UsageStore *usage_store_load (void);
+/* Writes the file if last used times changed since it was loaded or saved,
+ * or the key histogram did and it was not saved for a while */
+void usage_store_save (UsageStore *store);
+/* Writes the file if anything changed since it was loaded or saved */
+void usage_store_flush (UsageStore *store);
+void usage_store_free (UsageStore *store);
+
+/* Wall clock time in seconds of the last use, 0 if never used */
+gint64 usage_store_get_last_used (UsageStore *store,
+    const gchar *account_name);
+void usage_store_touch (UsageStore *store,
+    const gchar *account_name);
+void usage_store_forget (UsageStore *store,
+    const gchar *account_name);
+
+/* Histogram of the keys MC asks for, whatever the account */
+void usage_store_count_key (UsageStore *store,
+    const gchar *key);
+/* Returns up to max_keys of the most asked for keys, accessed at least
+ * min_count times, most asked for first; free with g_strfreev() */
+gchar **usage_store_dup_hot_keys (UsageStore *store,
+    guint max_keys,
+    guint64 min_count);
+
+G_END_DECLS
+
+#endif
@@ -1,3 +1,4 @@
 TEMPLATE = subdirs
 
-SUBDIRS += mcp-account-manager-accounts-sso
+SUBDIRS += mcp-account-manager-accounts-sso \
+        tools
@@ -0,0 +1,366 @@
+/*
+ * accounts-sso-oauth2-test.c
+ *
+ * Checks the OAuth2 token cache of the accounts-sso Mission Control plugin
+ * against a mock of signond and of the token endpoint behind it, with the
+ * auth data of accounts in a temporary accounts DB: a token is cached and
+ * handed out without asking again, refreshed before it expires, and not
+ * polled for when signond needs the user to log in. libaccounts needs a
+ * session bus, e.g. run it under dbus-run-session.
+ *
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include <libaccounts-glib/ag-account.h>
+#include <libaccounts-glib/ag-account-service.h>
+#include <libaccounts-glib/ag-auth-data.h>
+#include <libaccounts-glib/ag-manager.h>
+#include <libaccounts-glib/ag-service.h>
+
+#include <libsignon-glib/signon-auth-session.h>
+#include <libsignon-glib/signon-errors.h>
+
+#include "mock-signond.h"
+#include "oauth2-token-cache.h"
+#include "sandbox.h"
+
+#define SERVICE_NAME "oauth2-test-im"
+#define SERVICE_TYPE "IM"
+#define MECHANISM "web_server"
+
+/* Credentials ids of the accounts of each check */
+#define CACHED_ID 1
+#define REFRESH_ID 2
+#define NEEDS_UI_ID 3
+#define N_CREDENTIALS 4
+
+/* Lifetime of the token that gets refreshed; the cache refreshes it half
+ * way through, give or take the second g_timeout_add_seconds() allows */
+#define SHORT_EXPIRES_IN 4
+
+/* Longest wait for a token request to be answered */
+#define EVENT_TIMEOUT_MS 5000
+
+typedef struct
+{
+  OAuth2TokenCache *cache;
+  AgAuthData *auth_data[N_CREDENTIALS];
+  /* Tokens the cache announced per credentials id, and when it last did */
+  guint changes[N_CREDENTIALS];
+  gint64 changed_at[N_CREDENTIALS];
+} Test;
+
+static void
+_token_changed_cb (guint credentials_id,
+    gpointer user_data)
+{
+  Test *test = user_data;
+
+  g_assert (credentials_id < N_CREDENTIALS);
+  test->changes[credentials_id]++;
+  test->changed_at[credentials_id] = g_get_monotonic_time ();
+}
+
+static gboolean
+_timeout_cb (gpointer user_data)
+{
+  gboolean *timed_out = user_data;
+
+  *timed_out = TRUE;
+  return G_SOURCE_REMOVE;
+}
+
+/* Dispatches events until count reaches target */
+static gboolean
+_wait_for (guint *count,
+    guint target)
+{
+  gboolean timed_out = FALSE;
+  guint id;
+
+  if (*count >= target)
+    return TRUE;
+
+  id = g_timeout_add (EVENT_TIMEOUT_MS, _timeout_cb, &timed_out);
+  while (*count < target && !timed_out)
+    g_main_context_iteration (NULL, TRUE);
+
+  if (!timed_out)
+    g_source_remove (id);
+
+  return *count >= target;
+}
+
+/* Same for the replies of the mock, which it counts as they are taken */
+static gboolean
+_wait_for_replies (guint credentials_id,
+    guint target)
+{
+  gboolean timed_out = FALSE;
+  guint id;
+
+  id = g_timeout_add (EVENT_TIMEOUT_MS, _timeout_cb, &timed_out);
+  while (mock_signond_get_n_replies (credentials_id) < target && !timed_out)
+    g_main_context_iteration (NULL, TRUE);
+
+  if (!timed_out)
+    g_source_remove (id);
+
+  return mock_signond_get_n_replies (credentials_id) >= target;
+}
+
+static gboolean
+_check (gboolean condition,
+    const gchar *what)
+{
+  printf ("%s: %s\n", condition ? "ok" : "FAIL", what);
+  return condition;
+}
+
+static gboolean
+_check_token (Test *test,
+    guint credentials_id,
+    const gchar *expected,
+    const gchar *what)
+{
+  const gchar *token = oauth2_token_cache_peek (test->cache, credentials_id);
+
+  if (g_strcmp0 (token, expected) != 0)
+    fprintf (stderr, "credentials %u: got token %s, expected %s\n",
+        credentials_id, token != NULL ? token : "(none)",
+        expected != NULL ? expected : "(none)");
+
+  return _check (g_strcmp0 (token, expected) == 0, what);
+}
+
+/* Background requests must never bring up signon-ui */
+static gboolean
+_check_no_ui (guint credentials_id)
+{
+  GVariant *request = mock_signond_get_last_request (credentials_id);
+  gint32 policy = -1;
+
+  if (request != NULL)
+    g_variant_lookup (request, SIGNON_SESSION_DATA_UI_POLICY, "i", &policy);
+
+  return _check (policy == SIGNON_POLICY_NO_USER_INTERACTION,
+      "requests don't allow user interaction");
+}
+
+static gboolean
+_test_cached (Test *test)
+{
+  gboolean ok = TRUE;
+
+  mock_signond_push_reply (CACHED_ID, "cached-token", 3600, 0);
+
+  /* As during the plugin's startup */
+  oauth2_token_cache_watch (test->cache, test->auth_data[CACHED_ID]);
+  ok &= _check (mock_signond_get_n_requests (CACHED_ID) == 0,
+      "no request before the cache is started");
+
+  oauth2_token_cache_start (test->cache);
+  ok &= _check (_wait_for (&test->changes[CACHED_ID], 1),
+      "token announced once the cache is started");
+  ok &= _check_token (test, CACHED_ID, "cached-token", "token handed out");
+  ok &= _check_token (test, CACHED_ID, "cached-token",
+      "token handed out again");
+  ok &= _check (mock_signond_get_n_requests (CACHED_ID) == 1,
+      "cached token handed out without asking signond again");
+  ok &= _check_no_ui (CACHED_ID);
+
+  return ok;
+}
+
+static gboolean
+_test_refresh (Test *test)
+{
+  gboolean ok = TRUE;
+  gboolean forced = FALSE;
+  GVariant *request;
+  gint64 first_at;
+
+  mock_signond_push_reply (REFRESH_ID, "short-lived-token", SHORT_EXPIRES_IN,
+      0);
+  mock_signond_push_reply (REFRESH_ID, "refreshed-token", 3600, 0);
+
+  oauth2_token_cache_watch (test->cache, test->auth_data[REFRESH_ID]);
+  ok &= _check (_wait_for (&test->changes[REFRESH_ID], 1),
+      "short-lived token announced");
+  first_at = test->changed_at[REFRESH_ID];
+  ok &= _check_token (test, REFRESH_ID, "short-lived-token",
+      "short-lived token handed out");
+
+  ok &= _check (_wait_for (&test->changes[REFRESH_ID], 2),
+      "refreshed token announced");
+  ok &= _check (test->changed_at[REFRESH_ID] - first_at <
+      SHORT_EXPIRES_IN * G_USEC_PER_SEC, "token refreshed before it expired");
+  ok &= _check_token (test, REFRESH_ID, "refreshed-token",
+      "refreshed token handed out");
+
+  request = mock_signond_get_last_request (REFRESH_ID);
+  if (request != NULL)
+    g_variant_lookup (request, "ForceTokenRefresh", "b", &forced);
+  ok &= _check (forced, "refresh skips the OAuth2 plugin's own cache");
+  ok &= _check (mock_signond_get_n_requests (REFRESH_ID) == 2,
+      "one request per token");
+  ok &= _check_no_ui (REFRESH_ID);
+
+  return ok;
+}
+
+static gboolean
+_test_needs_ui (Test *test)
+{
+  gboolean ok = TRUE;
+
+  mock_signond_push_reply (NEEDS_UI_ID, NULL, 0,
+      SIGNON_ERROR_USER_INTERACTION);
+
+  oauth2_token_cache_watch (test->cache, test->auth_data[NEEDS_UI_ID]);
+  ok &= _check (_wait_for_replies (NEEDS_UI_ID, 1),
+      "request needing user interaction answered");
+  ok &= _check_token (test, NEEDS_UI_ID, NULL, "no token handed out");
+  ok &= _check (mock_signond_get_n_requests (NEEDS_UI_ID) == 1,
+      "no request again while user interaction is needed");
+  ok &= _check (test->changes[NEEDS_UI_ID] == 0, "no token announced");
+
+  /* The user logged in, e.g. through the settings, which changes the
+   * account */
+  mock_signond_push_reply (NEEDS_UI_ID, "after-login-token", 3600, 0);
+  oauth2_token_cache_retry (test->cache, NEEDS_UI_ID);
+  ok &= _check (_wait_for (&test->changes[NEEDS_UI_ID], 1),
+      "token announced after a retry");
+  ok &= _check_token (test, NEEDS_UI_ID, "after-login-token",
+      "token handed out after a retry");
+
+  return ok;
+}
+
+static AgAuthData *
+_create_account (AgManager *manager,
+    AgService *service,
+    guint credentials_id)
+{
+  AgAccount *account = ag_manager_create_account (manager, SANDBOX_PROVIDER);
+  AgAccountService *account_service;
+  AgAuthData *auth_data = NULL;
+  GError *error = NULL;
+  gchar *key;
+
+  ag_account_set_enabled (account, TRUE);
+  ag_account_select_service (account, service);
+  ag_account_set_enabled (account, TRUE);
+  ag_account_set_variant (account, "CredentialsId",
+      g_variant_new_uint32 (credentials_id));
+  ag_account_set_variant (account, "auth/method",
+      g_variant_new_string ("oauth2"));
+  ag_account_set_variant (account, "auth/mechanism",
+      g_variant_new_string (MECHANISM));
+  key = g_strdup_printf ("auth/oauth2/%s/ClientId", MECHANISM);
+  ag_account_set_variant (account, key, g_variant_new_string ("test-client"));
+  g_free (key);
+  ag_account_select_service (account, NULL);
+
+  if (!ag_account_store_blocking (account, &error))
+    {
+      fprintf (stderr, "cannot store account: %s\n", error->message);
+      g_error_free (error);
+      g_object_unref (account);
+      return NULL;
+    }
+
+  account_service = ag_account_service_new (account, service);
+  auth_data = ag_account_service_get_auth_data (account_service);
+  g_object_unref (account_service);
+  g_object_unref (account);
+
+  if (!oauth2_auth_data_is_oauth2 (auth_data))
+    {
+      fprintf (stderr, "libaccounts gives no OAuth2 auth data for the "
+          "account\n");
+      g_clear_pointer (&auth_data, ag_auth_data_unref);
+    }
+
+  return auth_data;
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GError *error = NULL;
+  Sandbox *sandbox;
+  AgManager *manager;
+  AgService *service;
+  Test test = { NULL, };
+  gboolean ok = TRUE;
+  guint i;
+
+  sandbox = sandbox_new (&error);
+  if (sandbox == NULL || !sandbox_add_service (sandbox, SERVICE_NAME,
+          SERVICE_TYPE, &error))
+    {
+      fprintf (stderr, "cannot create the accounts DB: %s\n", error->message);
+      sandbox_free (sandbox, FALSE);
+      return EXIT_FAILURE;
+    }
+
+  manager = ag_manager_new ();
+  service = ag_manager_get_service (manager, SERVICE_NAME);
+  if (service == NULL)
+    {
+      fprintf (stderr, "libaccounts does not see the sandbox services\n");
+      g_object_unref (manager);
+      sandbox_free (sandbox, FALSE);
+      return EXIT_FAILURE;
+    }
+
+  for (i = 1; i < N_CREDENTIALS && ok; i++)
+    {
+      test.auth_data[i] = _create_account (manager, service, i);
+      ok = (test.auth_data[i] != NULL);
+    }
+
+  if (ok)
+    {
+      test.cache = oauth2_token_cache_new (_token_changed_cb, &test);
+
+      ok &= _test_cached (&test);
+      ok &= _test_refresh (&test);
+      ok &= _test_needs_ui (&test);
+
+      for (i = 1; i < N_CREDENTIALS; i++)
+        oauth2_token_cache_unwatch (test.cache, i);
+      oauth2_token_cache_free (test.cache);
+    }
+
+  for (i = 1; i < N_CREDENTIALS; i++)
+    g_clear_pointer (&test.auth_data[i], ag_auth_data_unref);
+
+  mock_signond_reset ();
+  ag_service_unref (service);
+  g_object_unref (manager);
+  sandbox_free (sandbox, FALSE);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
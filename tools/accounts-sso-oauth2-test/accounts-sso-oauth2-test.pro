@@ -0,0 +1,29 @@
+TEMPLATE = app
+TARGET = accounts-sso-oauth2-test
+
+CONFIG  += link_pkgconfig use_c_linker
+CONFIG -= qt app_bundle
+
+# libsignon-glib is replaced by mock-signond.c; only its headers are used
+PKGCONFIG += gio-2.0 libaccounts-glib
+QMAKE_CFLAGS += $$system(pkg-config --cflags libsignon-glib)
+
+PLUGIN_DIR = ../../mcp-account-manager-accounts-sso
+COMMON_DIR = ../common
+INCLUDEPATH += $$PLUGIN_DIR $$COMMON_DIR
+
+SOURCES = accounts-sso-oauth2-test.c \
+        mock-signond.c \
+        $$PLUGIN_DIR/oauth2-token-cache.c \
+        $$PLUGIN_DIR/sso-log.c \
+        $$COMMON_DIR/sandbox.c
+
+HEADERS = mock-signond.h \
+        $$PLUGIN_DIR/oauth2-token-cache.h \
+        $$PLUGIN_DIR/sso-log.h \
+        $$COMMON_DIR/sandbox.h
+
+# "make check" runs it; libaccounts needs a session bus
+check.commands = dbus-run-session -- ./$$TARGET
+check.depends = $$TARGET
+QMAKE_EXTRA_TARGETS += check
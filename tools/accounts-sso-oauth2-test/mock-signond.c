@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "mock-signond.h"
+
+#include <gio/gio.h>
+
+#include <libsignon-glib/signon-identity.h>
+#include <libsignon-glib/signon-auth-session.h>
+#include <libsignon-glib/signon-errors.h>
+
+typedef struct
+{
+  gchar *token;
+  gint expires_in;
+  gint error_code;
+} MockReply;
+
+typedef struct
+{
+  /* Owned MockReplys, first to be given first */
+  GQueue replies;
+  guint n_requests;
+  guint n_replies;
+  GVariant *last_request;
+} MockCredentials;
+
+/* credentials id -> owned MockCredentials */
+static GHashTable *credentials = NULL;
+
+static void
+_mock_reply_free (gpointer data)
+{
+  MockReply *reply = data;
+
+  g_free (reply->token);
+  g_slice_free (MockReply, reply);
+}
+
+static void
+_mock_credentials_free (gpointer data)
+{
+  MockCredentials *creds = data;
+
+  g_queue_foreach (&creds->replies, (GFunc) _mock_reply_free, NULL);
+  g_queue_clear (&creds->replies);
+  if (creds->last_request != NULL)
+    g_variant_unref (creds->last_request);
+  g_slice_free (MockCredentials, creds);
+}
+
+static MockCredentials *
+_get_credentials (guint credentials_id)
+{
+  MockCredentials *creds;
+
+  if (credentials == NULL)
+    credentials = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+        NULL, _mock_credentials_free);
+
+  creds = g_hash_table_lookup (credentials, GUINT_TO_POINTER (credentials_id));
+  if (creds == NULL)
+    {
+      creds = g_slice_new0 (MockCredentials);
+      g_queue_init (&creds->replies);
+      g_hash_table_insert (credentials, GUINT_TO_POINTER (credentials_id),
+          creds);
+    }
+
+  return creds;
+}
+
+void
+mock_signond_push_reply (guint credentials_id,
+    const gchar *token,
+    gint expires_in,
+    gint error_code)
+{
+  MockReply *reply = g_slice_new0 (MockReply);
+
+  reply->token = g_strdup (token);
+  reply->expires_in = expires_in;
+  reply->error_code = error_code;
+  g_queue_push_tail (&_get_credentials (credentials_id)->replies, reply);
+}
+
+guint
+mock_signond_get_n_requests (guint credentials_id)
+{
+  return _get_credentials (credentials_id)->n_requests;
+}
+
+guint
+mock_signond_get_n_replies (guint credentials_id)
+{
+  return _get_credentials (credentials_id)->n_replies;
+}
+
+GVariant *
+mock_signond_get_last_request (guint credentials_id)
+{
+  return _get_credentials (credentials_id)->last_request;
+}
+
+void
+mock_signond_reset (void)
+{
+  g_clear_pointer (&credentials, g_hash_table_unref);
+}
+
+/* libsignon-glib */
+
+GQuark
+signon_error_quark (void)
+{
+  return g_quark_from_static_string ("signon-errors");
+}
+
+/* The instance structs are those of the real headers; only the credentials
+ * id is kept, as object data */
+#define CREDENTIALS_ID_KEY "mock-signond-credentials-id"
+
+G_DEFINE_TYPE (SignonIdentity, signon_identity, G_TYPE_OBJECT);
+G_DEFINE_TYPE (SignonAuthSession, signon_auth_session, G_TYPE_OBJECT);
+
+static void
+signon_identity_init (SignonIdentity *self)
+{
+}
+
+static void
+signon_identity_class_init (SignonIdentityClass *klass)
+{
+}
+
+static void
+signon_auth_session_init (SignonAuthSession *self)
+{
+}
+
+static void
+signon_auth_session_class_init (SignonAuthSessionClass *klass)
+{
+}
+
+SignonIdentity *
+signon_identity_new_from_db (guint32 id)
+{
+  SignonIdentity *identity = g_object_new (SIGNON_TYPE_IDENTITY, NULL);
+
+  g_object_set_data (G_OBJECT (identity), CREDENTIALS_ID_KEY,
+      GUINT_TO_POINTER (id));
+  return identity;
+}
+
+SignonAuthSession *
+signon_identity_create_session (SignonIdentity *self,
+    const gchar *method,
+    GError **error)
+{
+  SignonAuthSession *session = g_object_new (SIGNON_TYPE_AUTH_SESSION, NULL);
+
+  g_object_set_data (G_OBJECT (session), CREDENTIALS_ID_KEY,
+      g_object_get_data (G_OBJECT (self), CREDENTIALS_ID_KEY));
+  return session;
+}
+
+void
+signon_auth_session_process_async (SignonAuthSession *self,
+    GVariant *session_data,
+    const gchar *mechanism,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  guint id = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (self),
+          CREDENTIALS_ID_KEY));
+  MockCredentials *creds = _get_credentials (id);
+  MockReply *reply = g_queue_pop_head (&creds->replies);
+  GTask *task = g_task_new (self, cancellable, callback, user_data);
+
+  creds->n_requests++;
+  if (creds->last_request != NULL)
+    g_variant_unref (creds->last_request);
+  creds->last_request = g_variant_ref_sink (session_data);
+
+  /* GTask delivers it from the main loop, as a D-Bus reply would be */
+  if (reply == NULL)
+    {
+      g_task_return_new_error (task, SIGNON_ERROR, SIGNON_ERROR_UNKNOWN,
+          "no reply queued for credentials %u", id);
+    }
+  else if (reply->token == NULL)
+    {
+      g_task_return_new_error (task, SIGNON_ERROR, reply->error_code,
+          "mock error %d", reply->error_code);
+    }
+  else
+    {
+      GVariantBuilder builder;
+
+      g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+      g_variant_builder_add (&builder, "{sv}", "AccessToken",
+          g_variant_new_string (reply->token));
+      if (reply->expires_in > 0)
+        g_variant_builder_add (&builder, "{sv}", "ExpiresIn",
+            g_variant_new_int32 (reply->expires_in));
+
+      g_task_return_pointer (task,
+          g_variant_ref_sink (g_variant_builder_end (&builder)),
+          (GDestroyNotify) g_variant_unref);
+    }
+
+  if (reply != NULL)
+    _mock_reply_free (reply);
+  g_object_unref (task);
+}
+
+GVariant *
+signon_auth_session_process_finish (SignonAuthSession *self,
+    GAsyncResult *res,
+    GError **error)
+{
+  guint id = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (self),
+          CREDENTIALS_ID_KEY));
+
+  _get_credentials (id)->n_replies++;
+  return g_task_propagate_pointer (G_TASK (res), error);
+}
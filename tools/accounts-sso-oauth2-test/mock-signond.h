@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __MOCK_SIGNOND_H__
+#define __MOCK_SIGNOND_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Stands in for libsignon-glib, signond and the OAuth2 token endpoint
+ * behind it: the identities and auth sessions it creates answer each
+ * token request with the next reply queued for their credentials id, or
+ * fail if there is none. Only what the token cache uses is provided. */
+
+/* Queues a reply with the token, expiring after expires_in seconds (0 for
+ * never), or with the SignonError error_code if token is NULL */
+void mock_signond_push_reply (guint credentials_id,
+    const gchar *token,
+    gint expires_in,
+    gint error_code);
+
+/* Number of token requests made for the credentials id so far, and of
+ * those answered */
+guint mock_signond_get_n_requests (guint credentials_id);
+guint mock_signond_get_n_replies (guint credentials_id);
+
+/* Session data of the last request for the credentials id, or NULL */
+GVariant *mock_signond_get_last_request (guint credentials_id);
+
+void mock_signond_reset (void);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,394 @@
+/*
+ * accounts-sso-provision.c
+ *
+ * Writes the Telepathy account name and username of the accounts of a
+ * libaccounts DB, as the accounts-sso Mission Control plugin would when
+ * first seeing them, so it does not have to at first boot. The DB is the
+ * one libaccounts uses, i.e. the one in $ACCOUNTS if set.
+ *
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <libaccounts-glib/ag-account.h>
+#include <libaccounts-glib/ag-account-service.h>
+#include <libaccounts-glib/ag-auth-data.h>
+#include <libaccounts-glib/ag-manager.h>
+#include <libaccounts-glib/ag-service.h>
+
+#include <libsignon-glib/signon-identity.h>
+
+#include "account-name.h"
+
+#define DEFAULT_SERVICE_TYPES "IM"
+#define KEY_USERNAME "param-account"
+#define SIGNON_QUERY_TIMEOUT_SECONDS 5
+
+static gchar *service_types = NULL;
+static gchar **usernames = NULL;
+static gboolean no_signon = FALSE;
+static gboolean dry_run = FALSE;
+static gboolean verbose = FALSE;
+
+static GOptionEntry entries[] = {
+  { "service-types", 't', 0, G_OPTION_ARG_STRING, &service_types,
+    "Colon-separated service types to provision (default: "
+        DEFAULT_SERVICE_TYPES ")", "TYPES" },
+  { "username", 'u', 0, G_OPTION_ARG_STRING_ARRAY, &usernames,
+    "Username of an account, when not in its settings", "ID=USERNAME" },
+  { "no-signon", 0, 0, G_OPTION_ARG_NONE, &no_signon,
+    "Don't ask signond for missing usernames", NULL },
+  { "dry-run", 'n', 0, G_OPTION_ARG_NONE, &dry_run,
+    "Only print what would be written", NULL },
+  { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
+    "Also print the services already provisioned", NULL },
+  { NULL }
+};
+
+/* Outlives the wait for the reply if that times out, until the reply */
+typedef struct {
+  SignonIdentity *signon;
+  GMainLoop *loop;
+  gchar *username;
+  gboolean timed_out;
+} SignonQuery;
+
+static void
+_signon_query_free (SignonQuery *query)
+{
+  g_object_unref (query->signon);
+  if (query->loop != NULL)
+    g_main_loop_unref (query->loop);
+  g_free (query->username);
+  g_slice_free (SignonQuery, query);
+}
+
+static void
+_signon_info_cb (SignonIdentity *signon,
+    const SignonIdentityInfo *info,
+    const GError *error,
+    gpointer user_data)
+{
+  SignonQuery *query = user_data;
+
+  if (query->timed_out)
+    {
+      _signon_query_free (query);
+      return;
+    }
+
+  if (error != NULL)
+    fprintf (stderr, "signon query failed: %s\n", error->message);
+  else if (info != NULL)
+    query->username = g_strdup (signon_identity_info_get_username (info));
+
+  g_main_loop_quit (query->loop);
+}
+
+static gboolean
+_signon_timeout_cb (gpointer user_data)
+{
+  SignonQuery *query = user_data;
+
+  query->timed_out = TRUE;
+  g_main_loop_quit (query->loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Returns the username of the identity, or NULL */
+static gchar *
+_signon_dup_username (guint cred_id)
+{
+  SignonIdentity *signon = signon_identity_new_from_db (cred_id);
+  SignonQuery *query;
+  guint timeout_id;
+  gchar *username;
+
+  if (signon == NULL)
+    return NULL;
+
+  query = g_slice_new0 (SignonQuery);
+  query->signon = signon;
+  query->loop = g_main_loop_new (NULL, FALSE);
+  timeout_id = g_timeout_add_seconds (SIGNON_QUERY_TIMEOUT_SECONDS,
+      _signon_timeout_cb, query);
+
+  signon_identity_query_info (signon, _signon_info_cb, query);
+  g_main_loop_run (query->loop);
+
+  if (query->timed_out)
+    {
+      /* The reply callback frees it, whenever it comes */
+      fprintf (stderr, "signon query for cred_id %u timed out\n", cred_id);
+      return NULL;
+    }
+
+  g_source_remove (timeout_id);
+  username = query->username;
+  query->username = NULL;
+  _signon_query_free (query);
+
+  return username;
+}
+
+static gchar *
+_service_dup_string (AgAccountService *service,
+    const gchar *key)
+{
+  gchar *real_key = g_strconcat (KEY_PREFIX, key, NULL);
+  GVariant *value;
+
+  /* The value is owned by the service */
+  value = ag_account_service_get_variant (service, real_key, NULL);
+  g_free (real_key);
+
+  if (value == NULL || !g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
+    return NULL;
+
+  return g_variant_dup_string (value, NULL);
+}
+
+static void
+_service_set_string (AgAccountService *service,
+    const gchar *key,
+    const gchar *value)
+{
+  gchar *real_key = g_strconcat (KEY_PREFIX, key, NULL);
+
+  ag_account_service_set_variant (service, real_key,
+      g_variant_new_string (value));
+  g_free (real_key);
+}
+
+/* Returns the username of the service, from its settings, the command
+ * line or signond, or NULL */
+static gchar *
+_service_dup_username (AgAccountService *service,
+    GHashTable *given)
+{
+  AgAccount *account = ag_account_service_get_account (service);
+  const gchar *username;
+  AgAuthData *auth_data;
+  gchar *ret;
+
+  ret = _service_dup_string (service, KEY_USERNAME);
+  if (ret != NULL)
+    return ret;
+
+  username = g_hash_table_lookup (given, GUINT_TO_POINTER (account->id));
+  if (username != NULL)
+    return g_strdup (username);
+
+  if (no_signon)
+    return NULL;
+
+  auth_data = ag_account_service_get_auth_data (service);
+  if (auth_data == NULL)
+    return NULL;
+
+  ret = _signon_dup_username (ag_auth_data_get_credentials_id (auth_data));
+  ag_auth_data_unref (auth_data);
+
+  if (ret != NULL && ret[0] == '\0')
+    {
+      g_free (ret);
+      return NULL;
+    }
+
+  return ret;
+}
+
+/* Returns FALSE if the service could not be provisioned */
+static gboolean
+_provision_service (AgAccountService *service,
+    GHashTable *given,
+    GHashTable *to_store,
+    guint *provisioned)
+{
+  AgAccount *account = ag_account_service_get_account (service);
+  const gchar *service_name = ag_service_get_name (
+      ag_account_service_get_service (service));
+  gchar *account_name, *cm_name, *protocol_name, *username;
+
+  account_name = _service_dup_string (service, KEY_ACCOUNT_NAME);
+  if (account_name != NULL)
+    {
+      if (verbose)
+        printf ("%u %s: already %s\n", account->id, service_name,
+            account_name);
+      g_free (account_name);
+      return TRUE;
+    }
+
+  cm_name = _service_dup_string (service, "manager");
+  protocol_name = _service_dup_string (service, "protocol");
+  account_name = account_name_build (cm_name, protocol_name, service_name,
+      account->id);
+  g_free (cm_name);
+  g_free (protocol_name);
+
+  if (account_name == NULL)
+    {
+      fprintf (stderr, "%u %s: no manager/protocol, skipped\n", account->id,
+          service_name);
+      return FALSE;
+    }
+
+  /* The plugin only names services once it knows their username */
+  username = _service_dup_username (service, given);
+  if (username == NULL)
+    {
+      fprintf (stderr, "%u %s: no username, skipped\n", account->id,
+          service_name);
+      g_free (account_name);
+      return FALSE;
+    }
+
+  printf ("%u %s: %s (%s)\n", account->id, service_name, account_name,
+      username);
+
+  if (!dry_run)
+    {
+      _service_set_string (service, KEY_USERNAME, username);
+      _service_set_string (service, KEY_ACCOUNT_NAME, account_name);
+      g_hash_table_add (to_store, g_object_ref (account));
+    }
+
+  (*provisioned)++;
+
+  g_free (username);
+  g_free (account_name);
+  return TRUE;
+}
+
+/* Parses the ID=USERNAME options into a AgAccountId -> username table */
+static GHashTable *
+_parse_usernames (void)
+{
+  GHashTable *given = g_hash_table_new (g_direct_hash, g_direct_equal);
+  guint i;
+
+  for (i = 0; usernames != NULL && usernames[i] != NULL; i++)
+    {
+      gchar *sep = strchr (usernames[i], '=');
+      gchar *end = NULL;
+      guint64 id = 0;
+
+      if (sep != NULL)
+        id = g_ascii_strtoull (usernames[i], &end, 10);
+
+      if (sep == NULL || end != sep || id == 0 || id > G_MAXUINT ||
+          sep[1] == '\0')
+        {
+          fprintf (stderr, "ignoring invalid --username %s\n", usernames[i]);
+          continue;
+        }
+
+      g_hash_table_insert (given, GUINT_TO_POINTER ((guint) id), sep + 1);
+    }
+
+  return given;
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  AgManager *manager;
+  GHashTable *types, *given, *to_store;
+  GHashTableIter iter;
+  gpointer key;
+  GList *services;
+  gchar **split;
+  guint i, provisioned = 0, failed = 0;
+  int ret = EXIT_SUCCESS;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (context);
+
+  types = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  split = g_strsplit (service_types != NULL ? service_types :
+      DEFAULT_SERVICE_TYPES, ":", -1);
+  for (i = 0; split[i] != NULL; i++)
+    {
+      if (split[i][0] != '\0')
+        g_hash_table_add (types, g_strdup (split[i]));
+    }
+  g_strfreev (split);
+
+  given = _parse_usernames ();
+  to_store = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      g_object_unref, NULL);
+
+  manager = ag_manager_new ();
+  if (manager == NULL)
+    {
+      fprintf (stderr, "cannot open the accounts DB\n");
+      return EXIT_FAILURE;
+    }
+
+  services = ag_manager_get_account_services (manager);
+  while (services != NULL)
+    {
+      AgAccountService *service = services->data;
+      AgService *s = ag_account_service_get_service (service);
+
+      if (g_hash_table_contains (types, ag_service_get_service_type (s)) &&
+          !_provision_service (service, given, to_store, &provisioned))
+        failed++;
+
+      g_object_unref (service);
+      services = g_list_delete_link (services, services);
+    }
+
+  g_hash_table_iter_init (&iter, to_store);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      AgAccount *account = key;
+
+      if (!ag_account_store_blocking (account, &error))
+        {
+          fprintf (stderr, "%u: cannot store: %s\n", account->id,
+              error->message);
+          g_clear_error (&error);
+          ret = EXIT_FAILURE;
+        }
+    }
+
+  printf ("%u service(s) provisioned, %u skipped\n", provisioned, failed);
+
+  g_hash_table_unref (to_store);
+  g_hash_table_unref (given);
+  g_hash_table_unref (types);
+  g_object_unref (manager);
+
+  return ret;
+}
@@ -0,0 +1,17 @@
+TEMPLATE = app
+TARGET = accounts-sso-provision
+
+CONFIG  += link_pkgconfig use_c_linker
+CONFIG -= qt app_bundle
+PKGCONFIG += telepathy-glib libaccounts-glib libsignon-glib
+
+PLUGIN_DIR = ../../mcp-account-manager-accounts-sso
+INCLUDEPATH += $$PLUGIN_DIR
+
+SOURCES = accounts-sso-provision.c \
+        $$PLUGIN_DIR/account-name.c
+
+HEADERS = $$PLUGIN_DIR/account-name.h
+
+target.path = /usr/bin
+INSTALLS += target
@@ -0,0 +1,922 @@
+/*
+ * accounts-sso-replay.c
+ *
+ * Replays a trace recorded by the accounts-sso Mission Control plugin
+ * (see MC_ACCOUNTS_SSO_TRACE) against a new instance of the plugin. A
+ * temporary accounts DB stands in for the real one and a fake account
+ * manager for MC. The tool then compares the latency of each kind of event
+ * with the recorded one. libaccounts tells the plugin about the changes
+ * through D-Bus, so this needs a session bus, e.g. under dbus-run-session.
+ *
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <libaccounts-glib/ag-account.h>
+#include <libaccounts-glib/ag-manager.h>
+#include <libaccounts-glib/ag-service.h>
+
+#include <mission-control-plugins/mission-control-plugins.h>
+#include <telepathy-glib/telepathy-glib.h>
+
+#include "account-name.h"
+#include "event-trace.h"
+#include "fake-account-manager.h"
+#include "mcp-account-manager-accounts-sso.h"
+#include "sandbox.h"
+
+#define DEFAULT_SERVICE_TYPE "IM"
+/* For the accounts the trace names no service, manager or protocol of */
+#define DEFAULT_SERVICE "replay-im"
+#define DEFAULT_CM "replay"
+#define DEFAULT_PROTOCOL "replay"
+/* Time given to the last events to be delivered to the plugin */
+#define SETTLE_MS 1000
+
+static gdouble speed = 1.0;
+static gchar *service_type = NULL;
+static gchar *output = NULL;
+static gdouble max_slowdown = 0;
+static gboolean keep = FALSE;
+
+static GOptionEntry entries[] = {
+  { "speed", 's', 0, G_OPTION_ARG_DOUBLE, &speed,
+    "Replay this many times faster than recorded, 0 for no waits "
+    "(default: 1)", "FACTOR" },
+  { "service-type", 't', 0, G_OPTION_ARG_STRING, &service_type,
+    "Type of the replayed services (default: " DEFAULT_SERVICE_TYPE ")",
+    "TYPE" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output,
+    "Keep the trace of the replay in this file", "FILE" },
+  { "max-slowdown", 0, 0, G_OPTION_ARG_DOUBLE, &max_slowdown,
+    "Fail if an event is on average this many times slower than recorded",
+    "FACTOR" },
+  { "keep", 'k', 0, G_OPTION_ARG_NONE, &keep,
+    "Don't remove the temporary accounts DB", NULL },
+  { NULL }
+};
+
+typedef struct {
+  guint count;
+  gint64 total;
+  gint64 max;
+} EventStats;
+
+/* An account of the trace, and its stand-in in the sandbox */
+typedef struct {
+  guint trace_id;
+  gchar *cm;
+  gchar *protocol;
+  /* alloc'ed service name -> GINT_TO_POINTER (enabled before the trace) */
+  GHashTable *services;
+  /* The trace has its creation, so it is only created when replaying it */
+  gboolean created;
+  /* NULL while not in the sandbox */
+  AgAccount *account;
+} ReplayAccount;
+
+typedef struct {
+  AgManager *manager;
+  McpAccountStorage *storage;
+  McpAccountManager *am;
+  /* trace account id -> owned ReplayAccount */
+  GHashTable *accounts;
+  guint changes;
+  guint replayed;
+  guint skipped;
+} Replay;
+
+static void
+_replay_account_free (gpointer data)
+{
+  ReplayAccount *a = data;
+
+  g_clear_object (&a->account);
+  g_hash_table_unref (a->services);
+  g_free (a->cm);
+  g_free (a->protocol);
+  g_slice_free (ReplayAccount, a);
+}
+
+static void
+_record_free (gpointer data)
+{
+  EventTraceRecord *record = data;
+
+  g_free (record->name);
+  g_free (record->detail);
+  g_slice_free (EventTraceRecord, record);
+}
+
+static gboolean
+_is_iface (EventTraceEvent event)
+{
+  return event >= EVENT_TRACE_IFACE_GET && event < EVENT_TRACE_N_EVENTS;
+}
+
+/* Reads the records of the trace and adds them to stats; returns NULL if
+ * the file is not a trace */
+static GPtrArray *
+_read_trace (const gchar *path,
+    EventStats *stats)
+{
+  EventTraceRecord record = { 0, };
+  GPtrArray *records;
+  FILE *file;
+
+  file = fopen (path, "rb");
+  if (file == NULL || !event_trace_read_header (file, NULL))
+    {
+      fprintf (stderr, "%s: not an accounts-sso trace\n", path);
+      if (file != NULL)
+        fclose (file);
+      return NULL;
+    }
+
+  records = g_ptr_array_new_with_free_func (_record_free);
+  while (event_trace_read_record (file, &record))
+    {
+      EventTraceRecord *r;
+
+      if (record.event <= 0 || record.event >= EVENT_TRACE_N_EVENTS)
+        continue;
+
+      stats[record.event].count++;
+      stats[record.event].total += record.duration;
+      stats[record.event].max = MAX (stats[record.event].max,
+          record.duration);
+
+      r = g_slice_dup (EventTraceRecord, &record);
+      r->name = g_strdup (record.name);
+      r->detail = g_strdup (record.detail);
+      g_ptr_array_add (records, r);
+    }
+
+  fclose (file);
+  return records;
+}
+
+/* Earliest first, and containing events before the ones they contain */
+static gint
+_record_compare (gconstpointer a,
+    gconstpointer b)
+{
+  const EventTraceRecord *ra = *(EventTraceRecord * const *) a;
+  const EventTraceRecord *rb = *(EventTraceRecord * const *) b;
+
+  if (ra->start != rb->start)
+    return (ra->start < rb->start) ? -1 : 1;
+
+  if (ra->duration != rb->duration)
+    return (ra->duration > rb->duration) ? -1 : 1;
+
+  return 0;
+}
+
+/* Drops the storage calls made from within other events, i.e. MC reacting
+ * to the plugin's signals: the fake account manager does that itself. */
+static void
+_drop_nested_calls (GPtrArray *records)
+{
+  gint64 max_end = G_MININT64;
+  guint i = 0;
+
+  while (i < records->len)
+    {
+      EventTraceRecord *r = g_ptr_array_index (records, i);
+      gint64 end = r->start + r->duration;
+
+      if (_is_iface (r->event) && end <= max_end)
+        {
+          g_ptr_array_remove_index (records, i);
+          continue;
+        }
+
+      if (r->duration > 0)
+        max_end = MAX (max_end, end);
+      i++;
+    }
+}
+
+/* Reverses tp_escape_as_identifier() on the first len bytes of escaped */
+static gchar *
+_unescape_identifier (const gchar *escaped,
+    gsize len)
+{
+  GString *str = g_string_sized_new (len);
+  gsize i;
+
+  for (i = 0; i < len; i++)
+    {
+      if (escaped[i] == '_' && i + 2 < len &&
+          g_ascii_isxdigit (escaped[i + 1]) &&
+          g_ascii_isxdigit (escaped[i + 2]))
+        {
+          g_string_append_c (str, (g_ascii_xdigit_value (escaped[i + 1]) << 4) |
+              g_ascii_xdigit_value (escaped[i + 2]));
+          i += 2;
+        }
+      else if (escaped[i] != '_')
+        {
+          /* A lone "_" stands for the empty string */
+          g_string_append_c (str, escaped[i]);
+        }
+    }
+
+  return g_string_free (str, FALSE);
+}
+
+/* Splits an account name built by account_name_build() */
+static gboolean
+_parse_account_name (const gchar *name,
+    gchar **cm,
+    gchar **protocol,
+    gchar **service,
+    guint *id)
+{
+  gchar **parts;
+  const gchar *sep;
+  gchar *end;
+  guint64 n;
+  gboolean ret = FALSE;
+
+  if (tp_str_empty (name))
+    return FALSE;
+
+  parts = g_strsplit (name, "/", 3);
+  if (g_strv_length (parts) != 3)
+    goto out;
+
+  sep = strrchr (parts[2], '_');
+  if (sep == NULL || sep == parts[2])
+    goto out;
+
+  n = g_ascii_strtoull (sep + 1, &end, 10);
+  if (end == sep + 1 || *end != '\0' || n == 0 || n > G_MAXUINT)
+    goto out;
+
+  *cm = _unescape_identifier (parts[0], strlen (parts[0]));
+  *protocol = g_strdup (parts[1]);
+  *service = _unescape_identifier (parts[2], sep - parts[2]);
+  *id = n;
+  ret = TRUE;
+
+out:
+  g_strfreev (parts);
+  return ret;
+}
+
+static ReplayAccount *
+_ensure_account (Replay *replay,
+    guint id)
+{
+  ReplayAccount *a = g_hash_table_lookup (replay->accounts,
+      GUINT_TO_POINTER (id));
+
+  if (a != NULL)
+    return a;
+
+  a = g_slice_new0 (ReplayAccount);
+  a->trace_id = id;
+  a->services = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      NULL);
+  g_hash_table_insert (replay->accounts, GUINT_TO_POINTER (id), a);
+
+  return a;
+}
+
+static void
+_add_service (ReplayAccount *a,
+    const gchar *service_name,
+    gboolean enabled)
+{
+  if (!tp_str_empty (service_name) &&
+      !g_hash_table_contains (a->services, service_name))
+    g_hash_table_insert (a->services, g_strdup (service_name),
+        GINT_TO_POINTER (enabled));
+}
+
+/* Finds the accounts and services of the trace, and their state before it */
+static void
+_scan_accounts (Replay *replay,
+    GPtrArray *records)
+{
+  GHashTableIter iter;
+  gpointer value;
+  guint i;
+
+  for (i = 0; i < records->len; i++)
+    {
+      EventTraceRecord *r = g_ptr_array_index (records, i);
+      gchar *cm, *protocol, *service;
+      ReplayAccount *a;
+      guint id;
+
+      switch (r->event)
+        {
+          case EVENT_TRACE_ACCOUNT_CREATED:
+            _ensure_account (replay, r->account_id)->created = TRUE;
+            break;
+
+          case EVENT_TRACE_SERVICE_ENABLED:
+          case EVENT_TRACE_SERVICE_DISABLED:
+          case EVENT_TRACE_SERVICE_CHANGED:
+            /* Being enabled means it was not before */
+            _add_service (_ensure_account (replay, r->account_id), r->name,
+                r->event != EVENT_TRACE_SERVICE_ENABLED);
+            break;
+
+          default:
+            if (!_is_iface (r->event) ||
+                !_parse_account_name (r->name, &cm, &protocol, &service, &id))
+              break;
+
+            a = _ensure_account (replay, id);
+            if (a->cm == NULL)
+              {
+                a->cm = cm;
+                a->protocol = protocol;
+              }
+            else
+              {
+                g_free (cm);
+                g_free (protocol);
+              }
+            _add_service (a, service, TRUE);
+            g_free (service);
+            break;
+        }
+    }
+
+  g_hash_table_iter_init (&iter, replay->accounts);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      ReplayAccount *a = value;
+
+      if (a->cm == NULL)
+        {
+          a->cm = g_strdup (DEFAULT_CM);
+          a->protocol = g_strdup (DEFAULT_PROTOCOL);
+        }
+
+      if (g_hash_table_size (a->services) == 0)
+        _add_service (a, DEFAULT_SERVICE, TRUE);
+    }
+}
+
+static void
+_set_string (AgAccount *account,
+    const gchar *key,
+    const gchar *value)
+{
+  gchar *real_key = g_strconcat (KEY_PREFIX, key, NULL);
+
+  ag_account_set_variant (account, real_key, g_variant_new_string (value));
+  g_free (real_key);
+}
+
+/* Puts the account in the sandbox; known accounts get their MC account
+ * name, as if MC had seen them before */
+static gboolean
+_create_account (Replay *replay,
+    ReplayAccount *a,
+    gboolean known)
+{
+  AgAccount *account;
+  GHashTableIter iter;
+  gpointer key, value;
+  gchar *username;
+  GError *error = NULL;
+
+  account = ag_manager_create_account (replay->manager, SANDBOX_PROVIDER);
+  username = g_strdup_printf ("replay%u@example.com", a->trace_id);
+
+  /* Without the username the plugin would ask signond for it */
+  ag_account_set_enabled (account, TRUE);
+  g_hash_table_iter_init (&iter, a->services);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      AgService *s = ag_manager_get_service (replay->manager, key);
+
+      if (s == NULL)
+        continue;
+
+      ag_account_select_service (account, s);
+      ag_account_set_enabled (account, GPOINTER_TO_INT (value));
+      _set_string (account, "manager", a->cm);
+      _set_string (account, "protocol", a->protocol);
+      _set_string (account, "param-account", username);
+      ag_service_unref (s);
+    }
+  g_free (username);
+
+  /* The names need the account id */
+  if (ag_account_store_blocking (account, &error) && known)
+    {
+      g_hash_table_iter_init (&iter, a->services);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        {
+          AgService *s = ag_manager_get_service (replay->manager, key);
+          gchar *account_name;
+
+          if (s == NULL)
+            continue;
+
+          account_name = account_name_build (a->cm, a->protocol, key,
+              account->id);
+          ag_account_select_service (account, s);
+          _set_string (account, KEY_ACCOUNT_NAME, account_name);
+          g_free (account_name);
+          ag_service_unref (s);
+        }
+
+      ag_account_store_blocking (account, &error);
+    }
+
+  ag_account_select_service (account, NULL);
+
+  if (error != NULL)
+    {
+      fprintf (stderr, "cannot store account %u: %s\n", a->trace_id,
+          error->message);
+      g_error_free (error);
+      g_object_unref (account);
+      return FALSE;
+    }
+
+  a->account = account;
+  return TRUE;
+}
+
+static gboolean
+_delete_account (ReplayAccount *a)
+{
+  GError *error = NULL;
+
+  if (a->account == NULL)
+    return FALSE;
+
+  ag_account_delete (a->account);
+  if (!ag_account_store_blocking (a->account, &error))
+    {
+      fprintf (stderr, "cannot delete account %u: %s\n", a->trace_id,
+          error->message);
+      g_error_free (error);
+    }
+
+  g_clear_object (&a->account);
+  return TRUE;
+}
+
+/* Enables, disables or changes a setting of the service */
+static gboolean
+_update_service (Replay *replay,
+    ReplayAccount *a,
+    const gchar *service_name,
+    EventTraceEvent event)
+{
+  AgService *s;
+  GError *error = NULL;
+
+  if (a->account == NULL || tp_str_empty (service_name))
+    return FALSE;
+
+  s = ag_manager_get_service (replay->manager, service_name);
+  if (s == NULL)
+    return FALSE;
+
+  ag_account_select_service (a->account, s);
+
+  if (event == EVENT_TRACE_SERVICE_CHANGED)
+    {
+      gchar *nickname = g_strdup_printf ("replay %u", ++replay->changes);
+
+      _set_string (a->account, "Nickname", nickname);
+      g_free (nickname);
+    }
+  else
+    {
+      ag_account_set_enabled (a->account,
+          event == EVENT_TRACE_SERVICE_ENABLED);
+    }
+
+  ag_account_select_service (a->account, NULL);
+  ag_service_unref (s);
+
+  if (!ag_account_store_blocking (a->account, &error))
+    {
+      fprintf (stderr, "cannot store account %u: %s\n", a->trace_id,
+          error->message);
+      g_error_free (error);
+    }
+
+  return TRUE;
+}
+
+/* Returns the name of the sandbox account standing in for the one of the
+ * trace, or NULL if there is none */
+static gchar *
+_map_account_name (Replay *replay,
+    const gchar *name)
+{
+  gchar *cm, *protocol, *service, *ret = NULL;
+  ReplayAccount *a;
+  guint id;
+
+  if (!_parse_account_name (name, &cm, &protocol, &service, &id))
+    return NULL;
+
+  a = g_hash_table_lookup (replay->accounts, GUINT_TO_POINTER (id));
+  if (a != NULL && a->account != NULL)
+    ret = account_name_build (a->cm, a->protocol, service, a->account->id);
+
+  g_free (cm);
+  g_free (protocol);
+  g_free (service);
+  return ret;
+}
+
+/* Makes the storage call MC made; returns FALSE if it can't be replayed */
+static gboolean
+_replay_call (Replay *replay,
+    EventTraceRecord *r)
+{
+  const gchar *key = tp_str_empty (r->detail) ? NULL : r->detail;
+  gchar *name, *value;
+  GValue identifier = G_VALUE_INIT;
+  GHashTable *info;
+  GList *names;
+
+  switch (r->event)
+    {
+      case EVENT_TRACE_IFACE_LIST:
+        names = mcp_account_storage_list (replay->storage, replay->am);
+        g_list_free_full (names, g_free);
+        return TRUE;
+
+      case EVENT_TRACE_IFACE_COMMIT:
+        mcp_account_storage_commit (replay->storage, replay->am);
+        return TRUE;
+
+      case EVENT_TRACE_IFACE_READY:
+        mcp_account_storage_ready (replay->storage, replay->am);
+        return TRUE;
+
+      case EVENT_TRACE_IFACE_CREATE:
+        /* The parameters MC passed are not recorded */
+        return FALSE;
+
+      default:
+        break;
+    }
+
+  name = _map_account_name (replay, r->name);
+  if (name == NULL)
+    return FALSE;
+
+  switch (r->event)
+    {
+      case EVENT_TRACE_IFACE_GET:
+        mcp_account_storage_get (replay->storage, replay->am, name, key);
+        break;
+
+      case EVENT_TRACE_IFACE_SET:
+        if (key == NULL)
+          break;
+
+        /* Values are not recorded; write back what MC has */
+        value = mcp_account_manager_get_value (replay->am, name, key);
+        mcp_account_storage_set (replay->storage, replay->am, name, key,
+            value != NULL ? value : "replay");
+        g_free (value);
+        break;
+
+      case EVENT_TRACE_IFACE_DELETE:
+        mcp_account_storage_delete (replay->storage, replay->am, name, key);
+        break;
+
+      case EVENT_TRACE_IFACE_GET_IDENTIFIER:
+        mcp_account_storage_get_identifier (replay->storage, name,
+            &identifier);
+        if (G_IS_VALUE (&identifier))
+          g_value_unset (&identifier);
+        break;
+
+      case EVENT_TRACE_IFACE_GET_RESTRICTIONS:
+        mcp_account_storage_get_restrictions (replay->storage, name);
+        break;
+
+      case EVENT_TRACE_IFACE_GET_ADDITIONAL_INFO:
+        info = mcp_account_storage_get_additional_info (replay->storage,
+            name);
+        if (info != NULL)
+          g_hash_table_unref (info);
+        break;
+
+      default:
+        g_assert_not_reached ();
+    }
+
+  g_free (name);
+  return TRUE;
+}
+
+static gboolean
+_replay_record (Replay *replay,
+    EventTraceRecord *r)
+{
+  ReplayAccount *a = g_hash_table_lookup (replay->accounts,
+      GUINT_TO_POINTER (r->account_id));
+
+  switch (r->event)
+    {
+      case EVENT_TRACE_ACCOUNT_CREATED:
+        return a != NULL && a->account == NULL &&
+            _create_account (replay, a, FALSE);
+
+      case EVENT_TRACE_ACCOUNT_DELETED:
+        return a != NULL && _delete_account (a);
+
+      case EVENT_TRACE_SERVICE_ENABLED:
+      case EVENT_TRACE_SERVICE_DISABLED:
+      case EVENT_TRACE_SERVICE_CHANGED:
+        return a != NULL && _update_service (replay, a, r->name, r->event);
+
+      case EVENT_TRACE_SIGNON_INFO:
+        /* There is no signond here; the usernames are in the settings */
+        return FALSE;
+
+      default:
+        return _replay_call (replay, r);
+    }
+}
+
+/* MC reads accounts back when the plugin tells it they changed */
+
+static void
+_reload_cb (McpAccountStorage *storage,
+    const gchar *account_name,
+    Replay *replay)
+{
+  mcp_account_storage_get (storage, replay->am, account_name, NULL);
+}
+
+static void
+_altered_one_cb (McpAccountStorage *storage,
+    const gchar *account_name,
+    const gchar *key,
+    Replay *replay)
+{
+  mcp_account_storage_get (storage, replay->am, account_name, key);
+}
+
+static void
+_deleted_cb (McpAccountStorage *storage,
+    const gchar *account_name,
+    Replay *replay)
+{
+  fake_account_manager_forget (FAKE_ACCOUNT_MANAGER (replay->am),
+      account_name);
+}
+
+static gboolean
+_wake_cb (gpointer user_data)
+{
+  return G_SOURCE_REMOVE;
+}
+
+/* Dispatches events until the deadline, in monotonic time */
+static void
+_run_until (gint64 deadline)
+{
+  gint64 now;
+
+  while ((now = g_get_monotonic_time ()) < deadline)
+    {
+      GSource *source = g_timeout_source_new (
+          MAX ((deadline - now) / 1000, 1));
+
+      g_source_set_callback (source, _wake_cb, NULL, NULL);
+      g_source_attach (source, NULL);
+      g_main_context_iteration (NULL, TRUE);
+      g_source_destroy (source);
+      g_source_unref (source);
+    }
+}
+
+static void
+_print_stats (const gchar *event,
+    const EventStats *recorded,
+    const EventStats *replayed,
+    gboolean slower)
+{
+  printf ("%-20s %8u %10.3f %10.3f %8u %10.3f %10.3f%s\n", event,
+      recorded->count,
+      recorded->count > 0 ? recorded->total / 1000.0 / recorded->count : 0.0,
+      recorded->max / 1000.0,
+      replayed->count,
+      replayed->count > 0 ? replayed->total / 1000.0 / replayed->count : 0.0,
+      replayed->max / 1000.0,
+      slower ? "  SLOWER" : "");
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  EventStats recorded[EVENT_TRACE_N_EVENTS] = { { 0, } };
+  EventStats replayed[EVENT_TRACE_N_EVENTS] = { { 0, } };
+  GPtrArray *records, *result;
+  Replay replay = { 0, };
+  Sandbox *sandbox;
+  GHashTable *services;
+  GHashTableIter iter;
+  gpointer value;
+  gchar *trace_path;
+  gint64 t0 = 0, first_start = 0;
+  guint i, slower = 0;
+  int ret = EXIT_SUCCESS;
+
+  context = g_option_context_new ("TRACE-FILE");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (context);
+
+  if (argc != 2 || speed < 0)
+    {
+      fprintf (stderr, "Usage: %s [OPTION...] TRACE-FILE\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  records = _read_trace (argv[1], recorded);
+  if (records == NULL)
+    return EXIT_FAILURE;
+
+  g_ptr_array_sort (records, _record_compare);
+
+  replay.accounts = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      NULL, _replay_account_free);
+  _scan_accounts (&replay, records);
+  _drop_nested_calls (records);
+
+  sandbox = sandbox_new (&error);
+  if (sandbox == NULL)
+    {
+      fprintf (stderr, "cannot create the accounts DB: %s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  /* All the services must be there before the managers load them */
+  services = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_iter_init (&iter, replay.accounts);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      ReplayAccount *a = value;
+      GHashTableIter service_iter;
+      gpointer service_name;
+
+      g_hash_table_iter_init (&service_iter, a->services);
+      while (g_hash_table_iter_next (&service_iter, &service_name, NULL))
+        {
+          if (!g_hash_table_contains (services, service_name) &&
+              !sandbox_add_service (sandbox, service_name,
+                  service_type != NULL ? service_type : DEFAULT_SERVICE_TYPE,
+                  &error))
+            {
+              fprintf (stderr, "%s\n", error->message);
+              g_clear_error (&error);
+            }
+
+          g_hash_table_add (services, service_name);
+        }
+    }
+  g_hash_table_unref (services);
+
+  replay.manager = ag_manager_new ();
+
+  /* The accounts already there when recording */
+  g_hash_table_iter_init (&iter, replay.accounts);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      ReplayAccount *a = value;
+
+      if (!a->created)
+        _create_account (&replay, a, TRUE);
+    }
+
+  trace_path = (output != NULL) ? g_strdup (output) :
+      g_build_filename (sandbox_get_path (sandbox), "replay.trace", NULL);
+  g_setenv (EVENT_TRACE_ENV, trace_path, TRUE);
+
+  replay.storage = MCP_ACCOUNT_STORAGE (mcp_account_manager_accounts_sso_new ());
+  replay.am = MCP_ACCOUNT_MANAGER (fake_account_manager_new ());
+
+  g_signal_connect (replay.storage, "created", G_CALLBACK (_reload_cb),
+      &replay);
+  g_signal_connect (replay.storage, "altered", G_CALLBACK (_reload_cb),
+      &replay);
+  g_signal_connect (replay.storage, "altered-one",
+      G_CALLBACK (_altered_one_cb), &replay);
+  g_signal_connect (replay.storage, "deleted", G_CALLBACK (_deleted_cb),
+      &replay);
+
+  for (i = 0; i < records->len; i++)
+    {
+      EventTraceRecord *r = g_ptr_array_index (records, i);
+
+      if (i == 0)
+        {
+          t0 = g_get_monotonic_time ();
+          first_start = r->start;
+        }
+
+      if (speed > 0)
+        _run_until (t0 + (r->start - first_start) / speed);
+      else
+        while (g_main_context_iteration (NULL, FALSE));
+
+      if (_replay_record (&replay, r))
+        replay.replayed++;
+      else
+        replay.skipped++;
+    }
+
+  _run_until (g_get_monotonic_time () + SETTLE_MS * 1000);
+
+  /* Closes the trace */
+  g_signal_handlers_disconnect_by_data (replay.storage, &replay);
+  g_object_unref (replay.storage);
+  g_object_unref (replay.am);
+  g_hash_table_unref (replay.accounts);
+  g_object_unref (replay.manager);
+
+  printf ("%u event(s) replayed, %u skipped\n", replay.replayed,
+      replay.skipped);
+
+  result = _read_trace (trace_path, replayed);
+  if (result == NULL)
+    {
+      ret = EXIT_FAILURE;
+      goto out;
+    }
+  g_ptr_array_unref (result);
+
+  printf ("%-20s %8s %10s %10s %8s %10s %10s\n", "event", "recorded",
+      "avg ms", "max ms", "replayed", "avg ms", "max ms");
+  for (i = 1; i < EVENT_TRACE_N_EVENTS; i++)
+    {
+      gboolean is_slower = FALSE;
+
+      if (recorded[i].count == 0 && replayed[i].count == 0)
+        continue;
+
+      if (max_slowdown > 0 && recorded[i].count > 0 && replayed[i].count > 0)
+        is_slower = (gdouble) replayed[i].total / replayed[i].count >
+            max_slowdown * recorded[i].total / recorded[i].count;
+
+      if (is_slower)
+        slower++;
+
+      _print_stats (event_trace_event_name (i), &recorded[i], &replayed[i],
+          is_slower);
+    }
+
+  if (slower > 0)
+    {
+      printf ("%u event(s) more than %.1f times slower than recorded\n",
+          slower, max_slowdown);
+      ret = EXIT_FAILURE;
+    }
+
+out:
+  g_ptr_array_unref (records);
+  g_free (trace_path);
+  sandbox_free (sandbox, keep);
+
+  return ret;
+}
@@ -0,0 +1,11 @@
+TEMPLATE = app
+TARGET = accounts-sso-replay
+
+CONFIG -= qt app_bundle
+
+include(../common/plugin.pri)
+
+SOURCES += accounts-sso-replay.c
+
+target.path = /usr/bin
+INSTALLS += target
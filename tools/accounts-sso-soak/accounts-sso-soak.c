@@ -0,0 +1,529 @@
+/*
+ * accounts-sso-soak.c
+ *
+ * Runs the accounts-sso Mission Control plugin through thousands of
+ * account create, change, toggle and delete cycles against a temporary
+ * accounts DB, with a fake account manager standing in for MC, and fails
+ * if its memory or the number of objects it keeps alive grows. libaccounts
+ * tells the plugin about the changes through D-Bus, so this needs a
+ * session bus, e.g. under dbus-run-session. GObject instances are only
+ * counted with GOBJECT_DEBUG=instance-count.
+ *
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include <libaccounts-glib/ag-account.h>
+#include <libaccounts-glib/ag-account-service.h>
+#include <libaccounts-glib/ag-manager.h>
+#include <libaccounts-glib/ag-service.h>
+
+#include <libsignon-glib/signon-identity.h>
+
+#include <mission-control-plugins/mission-control-plugins.h>
+
+#include "account-name.h"
+#include "fake-account-manager.h"
+#include "mcp-account-manager-accounts-sso.h"
+#include "sandbox.h"
+#include "sso-counters.h"
+
+#define SERVICE_NAME "soak-im"
+#define SERVICE_TYPE "IM"
+#define CM_NAME "soak"
+#define PROTOCOL_NAME "soak"
+
+/* Longest wait for the plugin to react to a change */
+#define EVENT_TIMEOUT_MS 5000
+
+/* gint for G_OPTION_ARG_INT, checked after parsing */
+static gint cycles = 2000;
+static gint batch = 10;
+static gint samples = 10;
+static gint max_growth_kb = 2048;
+static gboolean lazy = FALSE;
+static gboolean keep = FALSE;
+
+static GOptionEntry entries[] = {
+  { "cycles", 'c', 0, G_OPTION_ARG_INT, &cycles,
+    "Number of accounts to go through (default: 2000)", "N" },
+  { "batch", 'b', 0, G_OPTION_ARG_INT, &batch,
+    "Number of accounts alive at once (default: 10)", "N" },
+  { "samples", 's', 0, G_OPTION_ARG_INT, &samples,
+    "Number of memory samples (default: 10)", "N" },
+  { "max-growth", 'g', 0, G_OPTION_ARG_INT, &max_growth_kb,
+    "Fail if RSS grows by more than this after the first sample "
+    "(default: 2048)", "KIB" },
+  { "lazy", 'l', 0, G_OPTION_ARG_NONE, &lazy,
+    "Run the plugin with MC_ACCOUNTS_SSO_LAZY_SERVICES=1", NULL },
+  { "keep", 'k', 0, G_OPTION_ARG_NONE, &keep,
+    "Don't remove the temporary accounts DB", NULL },
+  { NULL }
+};
+
+/* What the plugin told the fake MC so far */
+typedef struct {
+  McpAccountStorage *storage;
+  McpAccountManager *am;
+  guint created;
+  guint altered;
+  guint toggled;
+  guint deleted;
+} Soak;
+
+typedef struct {
+  gsize rss_kb;
+  gint accounts;
+  gint services;
+  gint identities;
+  guint64 counters[SSO_N_COUNTERS];
+} Sample;
+
+static void
+_created_cb (McpAccountStorage *storage,
+    const gchar *account_name,
+    Soak *soak)
+{
+  soak->created++;
+  mcp_account_storage_get (storage, soak->am, account_name, NULL);
+}
+
+static void
+_altered_cb (McpAccountStorage *storage,
+    const gchar *account_name,
+    Soak *soak)
+{
+  soak->altered++;
+  mcp_account_storage_get (storage, soak->am, account_name, NULL);
+}
+
+static void
+_toggled_cb (McpAccountStorage *storage,
+    const gchar *account_name,
+    gboolean enabled,
+    Soak *soak)
+{
+  soak->toggled++;
+}
+
+static void
+_deleted_cb (McpAccountStorage *storage,
+    const gchar *account_name,
+    Soak *soak)
+{
+  soak->deleted++;
+  fake_account_manager_forget (FAKE_ACCOUNT_MANAGER (soak->am), account_name);
+}
+
+static gboolean
+_timeout_cb (gpointer user_data)
+{
+  gboolean *timed_out = user_data;
+
+  *timed_out = TRUE;
+  return G_SOURCE_REMOVE;
+}
+
+/* Dispatches events until the plugin reported target of them */
+static gboolean
+_wait_for (guint *count,
+    guint target)
+{
+  gboolean timed_out = FALSE;
+  guint id;
+
+  if (*count >= target)
+    return TRUE;
+
+  id = g_timeout_add (EVENT_TIMEOUT_MS, _timeout_cb, &timed_out);
+  while (*count < target && !timed_out)
+    g_main_context_iteration (NULL, TRUE);
+
+  if (!timed_out)
+    g_source_remove (id);
+
+  return *count >= target;
+}
+
+static gboolean
+_store (AgAccount *account)
+{
+  GError *error = NULL;
+
+  if (ag_account_store_blocking (account, &error))
+    return TRUE;
+
+  fprintf (stderr, "cannot store account %u: %s\n", account->id,
+      error->message);
+  g_error_free (error);
+  return FALSE;
+}
+
+static void
+_set_string (AgAccount *account,
+    const gchar *key,
+    const gchar *value)
+{
+  gchar *real_key = g_strconcat (KEY_PREFIX, key, NULL);
+
+  ag_account_set_variant (account, real_key, g_variant_new_string (value));
+  g_free (real_key);
+}
+
+static AgAccount *
+_create_account (AgManager *manager,
+    AgService *service,
+    guint n)
+{
+  AgAccount *account = ag_manager_create_account (manager, SANDBOX_PROVIDER);
+  gchar *username = g_strdup_printf ("soak%u@example.com", n);
+
+  /* With a username, the plugin does not ask signond for it */
+  ag_account_set_enabled (account, TRUE);
+  ag_account_select_service (account, service);
+  ag_account_set_enabled (account, TRUE);
+  _set_string (account, "manager", CM_NAME);
+  _set_string (account, "protocol", PROTOCOL_NAME);
+  _set_string (account, "param-account", username);
+  ag_account_select_service (account, NULL);
+  g_free (username);
+
+  if (!_store (account))
+    g_clear_object (&account);
+
+  return account;
+}
+
+static gboolean
+_set_service (AgAccount *account,
+    AgService *service,
+    const gchar *nickname,
+    gint enabled)
+{
+  ag_account_select_service (account, service);
+  if (nickname != NULL)
+    _set_string (account, "Nickname", nickname);
+  if (enabled >= 0)
+    ag_account_set_enabled (account, enabled);
+  ag_account_select_service (account, NULL);
+
+  return _store (account);
+}
+
+/* What MC does with an account it knows */
+static void
+_use_account (Soak *soak,
+    AgAccount *account)
+{
+  gchar *account_name = account_name_build (CM_NAME, PROTOCOL_NAME,
+      SERVICE_NAME, account->id);
+  GValue identifier = G_VALUE_INIT;
+  GHashTable *info;
+
+  mcp_account_storage_get (soak->storage, soak->am, account_name, "Nickname");
+  mcp_account_storage_get (soak->storage, soak->am, account_name,
+      "param-password");
+  mcp_account_storage_set (soak->storage, soak->am, account_name,
+      "AutomaticPresence", "2;available;");
+  mcp_account_storage_commit (soak->storage, soak->am);
+
+  mcp_account_storage_get_identifier (soak->storage, account_name,
+      &identifier);
+  if (G_IS_VALUE (&identifier))
+    g_value_unset (&identifier);
+
+  mcp_account_storage_get_restrictions (soak->storage, account_name);
+  info = mcp_account_storage_get_additional_info (soak->storage,
+      account_name);
+  if (info != NULL)
+    g_hash_table_unref (info);
+
+  g_free (account_name);
+}
+
+static gsize
+_get_rss_kb (void)
+{
+  gchar *contents = NULL;
+  gchar **fields;
+  gsize ret = 0;
+
+  if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+    return 0;
+
+  fields = g_strsplit (contents, " ", 3);
+  if (g_strv_length (fields) >= 2)
+    ret = g_ascii_strtoull (fields[1], NULL, 10) * sysconf (_SC_PAGESIZE) /
+        1024;
+
+  g_strfreev (fields);
+  g_free (contents);
+  return ret;
+}
+
+static gint
+_count_instances (GType type)
+{
+#if GLIB_CHECK_VERSION (2, 44, 0)
+  return g_type_get_instance_count (type);
+#else
+  return 0;
+#endif
+}
+
+static void
+_sample (Sample *sample,
+    guint cycle)
+{
+  guint i;
+
+  sample->rss_kb = _get_rss_kb ();
+  sample->accounts = _count_instances (AG_TYPE_ACCOUNT);
+  sample->services = _count_instances (AG_TYPE_ACCOUNT_SERVICE);
+  sample->identities = _count_instances (SIGNON_TYPE_IDENTITY);
+
+  printf ("cycle %6u: rss %6" G_GSIZE_FORMAT " KiB, AgAccount %d, "
+      "AgAccountService %d, SignonIdentity %d\n", cycle, sample->rss_kb,
+      sample->accounts, sample->services, sample->identities);
+
+  for (i = 0; i < SSO_N_COUNTERS; i++)
+    {
+      sample->counters[i] = sso_counter_get (i);
+      if (sample->counters[i] > 0)
+        printf ("    %s %" G_GUINT64_FORMAT "\n", sso_counter_name (i),
+            sample->counters[i]);
+    }
+}
+
+/* Returns the number of problems between the first sample after warm up
+ * and the last one */
+static guint
+_check_growth (const Sample *first,
+    const Sample *last)
+{
+  guint problems = 0;
+
+  if (last->rss_kb > first->rss_kb + (gsize) max_growth_kb)
+    {
+      printf ("RSS grew by %" G_GSIZE_FORMAT " KiB\n",
+          last->rss_kb - first->rss_kb);
+      problems++;
+    }
+
+  if (last->accounts > first->accounts ||
+      last->services > first->services ||
+      last->identities > first->identities)
+    {
+      printf ("objects grew: AgAccount %+d, AgAccountService %+d, "
+          "SignonIdentity %+d\n", last->accounts - first->accounts,
+          last->services - first->services,
+          last->identities - first->identities);
+      problems++;
+    }
+
+  /* Loaded services are all dropped or evicted once their accounts are
+   * gone */
+  if (last->counters[SSO_COUNTER_SERVICES_MATERIALIZED] -
+          last->counters[SSO_COUNTER_SERVICES_EVICTED] >
+      first->counters[SSO_COUNTER_SERVICES_MATERIALIZED] -
+          first->counters[SSO_COUNTER_SERVICES_EVICTED])
+    {
+      printf ("loaded services grew\n");
+      problems++;
+    }
+
+  if (last->counters[SSO_COUNTER_STORE_FAILURES] > 0)
+    {
+      printf ("%" G_GUINT64_FORMAT " account store(s) failed\n",
+          last->counters[SSO_COUNTER_STORE_FAILURES]);
+      problems++;
+    }
+
+  return problems;
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  Sandbox *sandbox;
+  AgManager *manager;
+  AgService *service;
+  Soak soak = { 0, };
+  Sample first = { 0, }, last = { 0, };
+  GPtrArray *alive;
+  GList *names;
+  gboolean sampled = FALSE;
+  guint n, sample_every, next_sample, missed = 0, problems, held;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (context);
+
+  if (cycles < 1 || batch < 1 || samples < 2 || max_growth_kb < 0)
+    {
+      fprintf (stderr, "need some cycles, a batch, 2 samples or more, "
+          "and no negative growth\n");
+      return EXIT_FAILURE;
+    }
+
+  sandbox = sandbox_new (&error);
+  if (sandbox == NULL || !sandbox_add_service (sandbox, SERVICE_NAME,
+          SERVICE_TYPE, &error))
+    {
+      fprintf (stderr, "cannot create the accounts DB: %s\n", error->message);
+      sandbox_free (sandbox, keep);
+      return EXIT_FAILURE;
+    }
+
+  if (lazy)
+    g_setenv ("MC_ACCOUNTS_SSO_LAZY_SERVICES", "1", TRUE);
+
+  manager = ag_manager_new ();
+  service = ag_manager_get_service (manager, SERVICE_NAME);
+  if (service == NULL)
+    {
+      fprintf (stderr, "libaccounts does not see the sandbox services\n");
+      g_object_unref (manager);
+      sandbox_free (sandbox, keep);
+      return EXIT_FAILURE;
+    }
+
+  soak.storage = MCP_ACCOUNT_STORAGE (mcp_account_manager_accounts_sso_new ());
+  soak.am = MCP_ACCOUNT_MANAGER (fake_account_manager_new ());
+
+  g_signal_connect (soak.storage, "created", G_CALLBACK (_created_cb), &soak);
+  g_signal_connect (soak.storage, "altered", G_CALLBACK (_altered_cb), &soak);
+  g_signal_connect (soak.storage, "toggled", G_CALLBACK (_toggled_cb), &soak);
+  g_signal_connect (soak.storage, "deleted", G_CALLBACK (_deleted_cb), &soak);
+
+  /* As MC starts */
+  names = mcp_account_storage_list (soak.storage, soak.am);
+  g_list_free_full (names, g_free);
+  mcp_account_storage_ready (soak.storage, soak.am);
+
+  alive = g_ptr_array_new_with_free_func (g_object_unref);
+  sample_every = MAX ((guint) (cycles / samples), 1);
+  next_sample = sample_every;
+
+  for (n = 1; n <= (guint) cycles; n++)
+    {
+      AgAccount *account = _create_account (manager, service, n);
+      gchar *nickname;
+
+      if (account == NULL)
+        {
+          missed++;
+          break;
+        }
+
+      if (!_wait_for (&soak.created, n))
+        missed++;
+
+      nickname = g_strdup_printf ("soak %u", n);
+      if (_set_service (account, service, nickname, -1) &&
+          !_wait_for (&soak.altered, n))
+        missed++;
+      g_free (nickname);
+
+      if (_set_service (account, service, NULL, FALSE) &&
+          !_wait_for (&soak.toggled, 2 * n - 1))
+        missed++;
+      if (_set_service (account, service, NULL, TRUE) &&
+          !_wait_for (&soak.toggled, 2 * n))
+        missed++;
+
+      _use_account (&soak, account);
+      g_ptr_array_add (alive, account);
+
+      /* Keep only a few accounts around */
+      if (alive->len >= (guint) batch || n == (guint) cycles)
+        {
+          guint target = soak.deleted + alive->len;
+
+          while (alive->len > 0)
+            {
+              AgAccount *old = g_ptr_array_index (alive, alive->len - 1);
+
+              ag_account_delete (old);
+              _store (old);
+              g_ptr_array_remove_index (alive, alive->len - 1);
+            }
+
+          if (!_wait_for (&soak.deleted, target))
+            missed++;
+
+          /* Only sampled with no account around; the first sample is
+           * taken once warmed up */
+          if (n >= next_sample || n == (guint) cycles)
+            {
+              _sample (sampled ? &last : &first, n);
+              sampled = TRUE;
+              next_sample = n + sample_every;
+            }
+        }
+    }
+
+  g_ptr_array_unref (alive);
+
+  held = fake_account_manager_get_n_accounts (FAKE_ACCOUNT_MANAGER (soak.am));
+  printf ("%u account(s): %u created, %u altered, %u toggled, %u deleted "
+      "event(s), %u missed, MC holds %u account(s)\n", n - 1, soak.created,
+      soak.altered, soak.toggled, soak.deleted, missed, held);
+
+  if (last.rss_kb > 0)
+    {
+      problems = _check_growth (&first, &last);
+    }
+  else
+    {
+      printf ("too few cycles to compare samples\n");
+      problems = 1;
+    }
+
+  if (missed > 0 || held > 0)
+    problems++;
+
+  g_signal_handlers_disconnect_by_data (soak.storage, &soak);
+  g_object_unref (soak.storage);
+  g_object_unref (soak.am);
+  ag_service_unref (service);
+  g_object_unref (manager);
+  sandbox_free (sandbox, keep);
+
+  if (problems > 0)
+    {
+      printf ("FAILED\n");
+      return EXIT_FAILURE;
+    }
+
+  printf ("OK\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,13 @@
+TEMPLATE = app
+TARGET = accounts-sso-soak
+
+CONFIG -= qt app_bundle
+
+include(../common/plugin.pri)
+
+SOURCES += accounts-sso-soak.c
+
+# "make check" runs a short soak; libaccounts needs a session bus
+check.commands = dbus-run-session -- ./$$TARGET --cycles 500
+check.depends = $$TARGET
+QMAKE_EXTRA_TARGETS += check
@@ -0,0 +1,119 @@
+/*
+ * accounts-sso-trace.c
+ *
+ * Prints the events recorded by the accounts-sso Mission Control plugin
+ * when started with MC_ACCOUNTS_SSO_TRACE set, and their latencies.
+ *
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "event-trace.h"
+
+typedef struct {
+  guint count;
+  gint64 total;
+  gint64 max;
+} EventStats;
+
+static gboolean verbose = FALSE;
+
+static GOptionEntry entries[] = {
+  { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
+    "Print every event, not only the summary", NULL },
+  { NULL }
+};
+
+int
+main (int argc,
+    char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  EventStats stats[EVENT_TRACE_N_EVENTS] = { { 0, } };
+  EventTraceRecord record = { 0, };
+  gint64 wall_clock;
+  FILE *file;
+  guint i;
+
+  context = g_option_context_new ("TRACE-FILE");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (context);
+
+  if (argc != 2)
+    {
+      fprintf (stderr, "Usage: %s [-v] TRACE-FILE\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  file = fopen (argv[1], "rb");
+  if (file == NULL || !event_trace_read_header (file, &wall_clock))
+    {
+      fprintf (stderr, "%s: not an accounts-sso trace\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+
+  while (event_trace_read_record (file, &record))
+    {
+      EventStats *s;
+
+      if (record.event <= 0 || record.event >= EVENT_TRACE_N_EVENTS)
+        continue;
+
+      s = &stats[record.event];
+      s->count++;
+      s->total += record.duration;
+      s->max = MAX (s->max, record.duration);
+
+      if (verbose)
+        printf ("%10.3f ms %-20s %8.3f ms  %u %s %s\n",
+            record.start / 1000.0,
+            event_trace_event_name (record.event),
+            record.duration / 1000.0,
+            record.account_id,
+            record.name,
+            record.detail);
+    }
+
+  fclose (file);
+
+  printf ("%-20s %8s %12s %12s %12s\n", "event", "count", "total ms",
+      "avg ms", "max ms");
+  for (i = 1; i < EVENT_TRACE_N_EVENTS; i++)
+    {
+      if (stats[i].count == 0)
+        continue;
+
+      printf ("%-20s %8u %12.3f %12.3f %12.3f\n",
+          event_trace_event_name (i),
+          stats[i].count,
+          stats[i].total / 1000.0,
+          stats[i].total / 1000.0 / stats[i].count,
+          stats[i].max / 1000.0);
+    }
+
+  return EXIT_SUCCESS;
+}
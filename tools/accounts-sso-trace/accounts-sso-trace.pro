@@ -0,0 +1,19 @@
+TEMPLATE = app
+TARGET = accounts-sso-trace
+
+CONFIG  += link_pkgconfig use_c_linker
+CONFIG -= qt app_bundle
+PKGCONFIG += glib-2.0
+
+PLUGIN_DIR = ../../mcp-account-manager-accounts-sso
+INCLUDEPATH += $$PLUGIN_DIR
+
+SOURCES = accounts-sso-trace.c \
+        $$PLUGIN_DIR/event-trace.c \
+        $$PLUGIN_DIR/sso-log.c
+
+HEADERS = $$PLUGIN_DIR/event-trace.h \
+        $$PLUGIN_DIR/sso-log.h
+
+target.path = /usr/bin
+INSTALLS += target
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "fake-account-manager.h"
+
+struct _FakeAccountManager
+{
+  GObject parent;
+
+  /* alloc'ed account name -> (alloc'ed key -> alloc'ed value) */
+  GHashTable *accounts;
+};
+
+struct _FakeAccountManagerClass
+{
+  GObjectClass parent_class;
+};
+
+static void account_manager_iface_init (McpAccountManagerIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (FakeAccountManager, fake_account_manager,
+    G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (MCP_TYPE_ACCOUNT_MANAGER,
+        account_manager_iface_init));
+
+static void
+fake_account_manager_init (FakeAccountManager *self)
+{
+  self->accounts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) g_hash_table_unref);
+}
+
+static void
+fake_account_manager_finalize (GObject *object)
+{
+  FakeAccountManager *self = FAKE_ACCOUNT_MANAGER (object);
+
+  g_hash_table_unref (self->accounts);
+
+  G_OBJECT_CLASS (fake_account_manager_parent_class)->finalize (object);
+}
+
+static void
+fake_account_manager_class_init (FakeAccountManagerClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = fake_account_manager_finalize;
+}
+
+static void
+_set_value (const McpAccountManager *ma,
+    const gchar *acct,
+    const gchar *key,
+    const gchar *value)
+{
+  FakeAccountManager *self = FAKE_ACCOUNT_MANAGER (ma);
+  GHashTable *values = g_hash_table_lookup (self->accounts, acct);
+
+  if (value == NULL)
+    {
+      if (values != NULL)
+        g_hash_table_remove (values, key);
+      return;
+    }
+
+  if (values == NULL)
+    {
+      values = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+          g_free);
+      g_hash_table_insert (self->accounts, g_strdup (acct), values);
+    }
+
+  g_hash_table_replace (values, g_strdup (key), g_strdup (value));
+}
+
+static gchar *
+_get_value (const McpAccountManager *ma,
+    const gchar *acct,
+    const gchar *key)
+{
+  FakeAccountManager *self = FAKE_ACCOUNT_MANAGER (ma);
+  GHashTable *values = g_hash_table_lookup (self->accounts, acct);
+
+  if (values == NULL)
+    return NULL;
+
+  return g_strdup (g_hash_table_lookup (values, key));
+}
+
+static gboolean
+_is_secret (const McpAccountManager *ma,
+    const gchar *acct,
+    const gchar *key)
+{
+  return FALSE;
+}
+
+static void
+_make_secret (const McpAccountManager *ma,
+    const gchar *acct,
+    const gchar *key)
+{
+}
+
+static gchar *
+_unique_name (const McpAccountManager *ma,
+    const gchar *manager,
+    const gchar *protocol,
+    const GHashTable *params)
+{
+  static guint n = 0;
+
+  return g_strdup_printf ("%s/%s/fake%u", manager, protocol, ++n);
+}
+
+static GStrv
+_list_keys (const McpAccountManager *ma,
+    const gchar *acct)
+{
+  FakeAccountManager *self = FAKE_ACCOUNT_MANAGER (ma);
+  GHashTable *values = g_hash_table_lookup (self->accounts, acct);
+  GPtrArray *keys = g_ptr_array_new ();
+  GHashTableIter iter;
+  gpointer key;
+
+  if (values != NULL)
+    {
+      g_hash_table_iter_init (&iter, values);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        g_ptr_array_add (keys, g_strdup (key));
+    }
+
+  g_ptr_array_add (keys, NULL);
+  return (GStrv) g_ptr_array_free (keys, FALSE);
+}
+
+static void
+account_manager_iface_init (McpAccountManagerIface *iface)
+{
+  iface->set_value = _set_value;
+  iface->get_value = _get_value;
+  iface->is_secret = _is_secret;
+  iface->make_secret = _make_secret;
+  iface->unique_name = _unique_name;
+  iface->list_keys = _list_keys;
+}
+
+FakeAccountManager *
+fake_account_manager_new (void)
+{
+  return g_object_new (FAKE_TYPE_ACCOUNT_MANAGER, NULL);
+}
+
+void
+fake_account_manager_forget (FakeAccountManager *self,
+    const gchar *account_name)
+{
+  g_hash_table_remove (self->accounts, account_name);
+}
+
+guint
+fake_account_manager_get_n_accounts (FakeAccountManager *self)
+{
+  return g_hash_table_size (self->accounts);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __FAKE_ACCOUNT_MANAGER_H__
+#define __FAKE_ACCOUNT_MANAGER_H__
+
+#include <glib-object.h>
+
+#include <mission-control-plugins/mission-control-plugins.h>
+
+G_BEGIN_DECLS
+
+/* Stands in for MC's account manager when the tools drive the plugin:
+ * values set by the plugin are kept per account, as MC would. */
+#define FAKE_TYPE_ACCOUNT_MANAGER (fake_account_manager_get_type ())
+#define FAKE_ACCOUNT_MANAGER(o) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((o), FAKE_TYPE_ACCOUNT_MANAGER, \
+      FakeAccountManager))
+
+typedef struct _FakeAccountManager FakeAccountManager;
+typedef struct _FakeAccountManagerClass FakeAccountManagerClass;
+
+GType fake_account_manager_get_type (void) G_GNUC_CONST;
+
+FakeAccountManager *fake_account_manager_new (void);
+
+/* Drops the values of a deleted account */
+void fake_account_manager_forget (FakeAccountManager *self,
+    const gchar *account_name);
+
+/* Number of accounts with values */
+guint fake_account_manager_get_n_accounts (FakeAccountManager *self);
+
+G_END_DECLS
+
+#endif
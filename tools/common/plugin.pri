@@ -0,0 +1,36 @@
+# Builds the plugin into a tool, along with the stand-ins used to drive it
+# without MC and against a temporary accounts DB.
+
+PLUGIN_DIR = $$PWD/../../mcp-account-manager-accounts-sso
+INCLUDEPATH += $$PLUGIN_DIR $$PWD
+
+CONFIG += link_pkgconfig use_c_linker
+PKGCONFIG += mission-control-plugins libaccounts-glib libsignon-glib
+
+SOURCES += $$PLUGIN_DIR/mcp-account-manager-accounts-sso.c \
+        $$PLUGIN_DIR/oauth2-token-cache.c \
+        $$PLUGIN_DIR/event-trace.c \
+        $$PLUGIN_DIR/startup-profile.c \
+        $$PLUGIN_DIR/usage-store.c \
+        $$PLUGIN_DIR/sso-counters.c \
+        $$PLUGIN_DIR/store-tracker.c \
+        $$PLUGIN_DIR/account-cache.c \
+        $$PLUGIN_DIR/account-name.c \
+        $$PLUGIN_DIR/protocol-schema.c \
+        $$PLUGIN_DIR/sso-log.c \
+        $$PWD/sandbox.c \
+        $$PWD/fake-account-manager.c
+
+HEADERS += $$PLUGIN_DIR/mcp-account-manager-accounts-sso.h \
+        $$PLUGIN_DIR/oauth2-token-cache.h \
+        $$PLUGIN_DIR/event-trace.h \
+        $$PLUGIN_DIR/startup-profile.h \
+        $$PLUGIN_DIR/usage-store.h \
+        $$PLUGIN_DIR/sso-counters.h \
+        $$PLUGIN_DIR/store-tracker.h \
+        $$PLUGIN_DIR/account-cache.h \
+        $$PLUGIN_DIR/account-name.h \
+        $$PLUGIN_DIR/protocol-schema.h \
+        $$PLUGIN_DIR/sso-log.h \
+        $$PWD/sandbox.h \
+        $$PWD/fake-account-manager.h
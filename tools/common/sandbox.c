@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "sandbox.h"
+
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+struct _Sandbox
+{
+  gchar *path;
+  gchar *services_dir;
+};
+
+static gboolean
+_write_file (const gchar *dir,
+    const gchar *name,
+    const gchar *contents,
+    GError **error)
+{
+  gchar *path = g_build_filename (dir, name, NULL);
+  gboolean ret = g_file_set_contents (path, contents, -1, error);
+
+  g_free (path);
+  return ret;
+}
+
+static gchar *
+_make_subdir (const gchar *path,
+    const gchar *name)
+{
+  gchar *dir = g_build_filename (path, name, NULL);
+
+  g_mkdir (dir, 0700);
+  return dir;
+}
+
+static void
+_remove_tree (const gchar *path)
+{
+  GDir *dir = g_dir_open (path, 0, NULL);
+  const gchar *name;
+
+  if (dir != NULL)
+    {
+      while ((name = g_dir_read_name (dir)) != NULL)
+        {
+          gchar *child = g_build_filename (path, name, NULL);
+
+          if (g_file_test (child, G_FILE_TEST_IS_DIR) &&
+              !g_file_test (child, G_FILE_TEST_IS_SYMLINK))
+            _remove_tree (child);
+          else
+            g_unlink (child);
+
+          g_free (child);
+        }
+      g_dir_close (dir);
+    }
+
+  g_rmdir (path);
+}
+
+Sandbox *
+sandbox_new (GError **error)
+{
+  Sandbox *sandbox;
+  gchar *path, *providers_dir, *data_dir, *provider;
+
+  path = g_dir_make_tmp ("accounts-sso-XXXXXX", error);
+  if (path == NULL)
+    return NULL;
+
+  sandbox = g_slice_new0 (Sandbox);
+  sandbox->path = path;
+  sandbox->services_dir = _make_subdir (path, "services");
+  providers_dir = _make_subdir (path, "providers");
+  data_dir = _make_subdir (path, "data");
+
+  provider = g_markup_printf_escaped (
+      "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      "<provider id=\"%s\">\n"
+      "  <name>%s</name>\n"
+      "</provider>\n", SANDBOX_PROVIDER, SANDBOX_PROVIDER);
+
+  if (!_write_file (providers_dir, SANDBOX_PROVIDER ".provider", provider,
+          error))
+    {
+      sandbox_free (sandbox, FALSE);
+      sandbox = NULL;
+      goto out;
+    }
+
+  g_setenv ("ACCOUNTS", path, TRUE);
+  g_setenv ("AG_SERVICES", sandbox->services_dir, TRUE);
+  g_setenv ("AG_PROVIDERS", providers_dir, TRUE);
+  /* Keeps the plugin's usage data out of the user's */
+  g_setenv ("XDG_DATA_HOME", data_dir, TRUE);
+
+out:
+  g_free (provider);
+  g_free (data_dir);
+  g_free (providers_dir);
+  return sandbox;
+}
+
+void
+sandbox_free (Sandbox *sandbox,
+    gboolean keep)
+{
+  if (sandbox == NULL)
+    return;
+
+  if (keep)
+    g_printerr ("sandbox kept in %s\n", sandbox->path);
+  else
+    _remove_tree (sandbox->path);
+
+  g_free (sandbox->services_dir);
+  g_free (sandbox->path);
+  g_slice_free (Sandbox, sandbox);
+}
+
+const gchar *
+sandbox_get_path (Sandbox *sandbox)
+{
+  return sandbox->path;
+}
+
+gboolean
+sandbox_add_service (Sandbox *sandbox,
+    const gchar *service_name,
+    const gchar *service_type,
+    GError **error)
+{
+  gchar *file, *contents;
+  gboolean ret;
+
+  if (strchr (service_name, '/') != NULL || service_name[0] == '.')
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+          "invalid service name %s", service_name);
+      return FALSE;
+    }
+
+  contents = g_markup_printf_escaped (
+      "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      "<service id=\"%s\">\n"
+      "  <type>%s</type>\n"
+      "  <name>%s</name>\n"
+      "  <provider>%s</provider>\n"
+      "</service>\n", service_name, service_type, service_name,
+      SANDBOX_PROVIDER);
+  file = g_strconcat (service_name, ".service", NULL);
+
+  ret = _write_file (sandbox->services_dir, file, contents, error);
+
+  g_free (file);
+  g_free (contents);
+  return ret;
+}
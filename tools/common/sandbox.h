@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __SANDBOX_H__
+#define __SANDBOX_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A temporary libaccounts DB, with its own service and provider files, for
+ * the tools driving the plugin. Creating it points $ACCOUNTS, $AG_SERVICES,
+ * $AG_PROVIDERS and $XDG_DATA_HOME at it, so it must be created before any
+ * AgManager, and before anything asks GLib for the user data dir. */
+typedef struct _Sandbox Sandbox;
+
+/* Name of the provider of all the sandbox services */
+#define SANDBOX_PROVIDER "sandbox"
+
+Sandbox *sandbox_new (GError **error);
+/* Removes the sandbox directory unless keep is set */
+void sandbox_free (Sandbox *sandbox,
+    gboolean keep);
+
+const gchar *sandbox_get_path (Sandbox *sandbox);
+
+/* Services must all be added before the first AgManager is created */
+gboolean sandbox_add_service (Sandbox *sandbox,
+    const gchar *service_name,
+    const gchar *service_type,
+    GError **error);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,7 @@
+TEMPLATE = subdirs
+
+SUBDIRS += accounts-sso-trace \
+        accounts-sso-replay \
+        accounts-sso-soak \
+        accounts-sso-provision \
+        accounts-sso-oauth2-test